@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "assetcache.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFontMetrics>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QRunnable>
+#include <QSaveFile>
+#include <functional>
+
+/**
+ * @brief Identifies scaled image files, followed by a format version.
+ */
+static const quint32 DISK_MAGIC = 0x51565041;
+static const quint32 DISK_VERSION = 1;
+
+class PreloadTask : public QRunnable
+{
+public:
+
+    PreloadTask(const std::function<void()>& job)
+        : m_job(job)
+    {}
+
+    virtual void run() override
+    {
+        m_job();
+    }
+
+private:
+
+    std::function<void()> m_job;
+};
+
+uint qHash(const AssetCache::Key& key, uint seed)
+{
+    return qHash(key.name, seed) ^ qHash(key.size.width(), seed) ^
+        qHash(key.size.height() << 16, seed) ^
+        qHash((key.mode << 8) | key.transform, seed) ^ qHash(key.color, seed);
+}
+
+AssetCache& AssetCache::instance()
+{
+    static AssetCache cache;
+    return cache;
+}
+
+AssetCache::AssetCache(size_t limit)
+    : m_limit(limit),
+      m_bytes(0),
+      m_hits(0),
+      m_misses(0),
+      m_diskHits(0)
+{
+}
+
+void AssetCache::setLimit(size_t bytes)
+{
+    QMutexLocker lock(&m_lock);
+    m_limit = bytes;
+    trim(0);
+}
+
+bool AssetCache::lookup(const Key& key, QImage& image)
+{
+    QMutexLocker lock(&m_lock);
+
+    auto i = m_index.find(key);
+    if (i == m_index.end())
+    {
+        m_misses++;
+        return false;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, i.value());
+    image = i.value()->image;
+    m_hits++;
+
+    return true;
+}
+
+void AssetCache::insert(const Key& key, const QImage& image)
+{
+    QMutexLocker lock(&m_lock);
+
+    m_loading.remove(key);
+    m_loaded.wakeAll();
+
+    // another thread may have created the same entry meanwhile
+    if (m_index.contains(key))
+        return;
+
+    m_entries.push_front({key, image});
+    m_index.insert(key, m_entries.begin());
+    m_bytes += image.sizeInBytes();
+
+    // never evict the entry just inserted, it is about to be used
+    trim(1);
+}
+
+void AssetCache::trim(size_t keep)
+{
+    while (m_bytes > m_limit && m_entries.size() > keep)
+    {
+        const Entry& last = m_entries.back();
+        m_bytes -= last.image.sizeInBytes();
+        m_index.remove(last.key);
+        m_entries.pop_back();
+    }
+}
+
+bool AssetCache::claim(const Key& key, QImage& image)
+{
+    QMutexLocker lock(&m_lock);
+
+    while (m_loading.contains(key))
+        m_loaded.wait(&m_lock);
+
+    auto i = m_index.find(key);
+    if (i == m_index.end())
+    {
+        m_loading.insert(key);
+        m_misses++;
+        return false;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, i.value());
+    image = i.value()->image;
+    m_hits++;
+
+    return true;
+}
+
+void AssetCache::preload(const QString& path, const QSize& size,
+                         Qt::AspectRatioMode mode, int transform)
+{
+    m_pool.start(new PreloadTask([this, path, size, mode, transform]() {
+        load(path, size, mode, transform, true);
+    }));
+}
+
+void AssetCache::waitForPreload()
+{
+    m_pool.waitForDone();
+}
+
+void AssetCache::setDiskCache(const QString& dir)
+{
+    if (!dir.isEmpty() && !QDir().mkpath(dir))
+    {
+        qDebug() << "can't create asset disk cache " << dir;
+        return;
+    }
+
+    QMutexLocker lock(&m_lock);
+    m_disk = dir;
+}
+
+QString AssetCache::diskPath(const QString& dir, const Key& key)
+{
+    QString digest;
+    {
+        QMutexLocker lock(&m_lock);
+        digest = m_hashes.value(key.name);
+    }
+
+    // each size of an asset is named after the same hash, read the file once
+    if (digest.isEmpty())
+    {
+        QFile file(key.name);
+        if (!file.open(QIODevice::ReadOnly))
+            return QString();
+
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        if (!hash.addData(&file))
+            return QString();
+
+        digest = QString::fromLatin1(hash.result().toHex());
+
+        QMutexLocker lock(&m_lock);
+        m_hashes.insert(key.name, digest);
+    }
+
+    return QString("%1/%2-%3x%4-%5-%6.argb")
+        .arg(dir)
+        .arg(digest)
+        .arg(key.size.width())
+        .arg(key.size.height())
+        .arg(key.mode)
+        .arg(key.transform);
+}
+
+bool AssetCache::readDisk(const QString& path, QImage& image)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version, width, height, pitch;
+    in >> magic >> version >> width >> height >> pitch;
+    if (in.status() != QDataStream::Ok || magic != DISK_MAGIC || version != DISK_VERSION ||
+        pitch != width * 4)
+        return false;
+
+    QImage result(width, height, QImage::Format_ARGB32_Premultiplied);
+    if (result.isNull())
+        return false;
+
+    for (quint32 y = 0; y < height; y++)
+    {
+        if (in.readRawData(reinterpret_cast<char*>(result.scanLine(y)), pitch) != (int)pitch)
+            return false;
+    }
+
+    image = result;
+    return true;
+}
+
+void AssetCache::writeDisk(const QString& path, const QImage& image)
+{
+    // written to a temporary file and renamed, so a partial file is never read
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    quint32 pitch = image.width() * 4;
+
+    QDataStream out(&file);
+    out << DISK_MAGIC << DISK_VERSION << (quint32)image.width() << (quint32)image.height()
+        << pitch;
+    for (int y = 0; y < image.height(); y++)
+        out.writeRawData(reinterpret_cast<const char*>(image.constScanLine(y)), pitch);
+
+    if (!file.commit())
+        qDebug() << "failed to write " << path;
+}
+
+QImage AssetCache::image(const QString& path, const QSize& size,
+                         Qt::AspectRatioMode mode, int transform)
+{
+    return load(path, size, mode, transform, false);
+}
+
+QImage AssetCache::load(const QString& path, const QSize& size,
+                        Qt::AspectRatioMode mode, int transform, bool disk)
+{
+    Key key = {path, size, mode, transform, 0};
+
+    QImage result;
+    if (claim(key, result))
+        return result;
+
+    qDebug() << "asset cache miss " << path << size;
+
+    QString file;
+    if (disk && size.isValid())
+    {
+        {
+            QMutexLocker lock(&m_lock);
+            file = m_disk;
+        }
+
+        if (!file.isEmpty())
+            file = diskPath(file, key);
+
+        if (!file.isEmpty() && readDisk(file, result))
+        {
+            {
+                QMutexLocker lock(&m_lock);
+                m_diskHits++;
+            }
+
+            insert(key, result);
+            return result;
+        }
+    }
+
+    if (size.isValid() || transform != None)
+    {
+        // derive from the decoded image, which is cached too
+        result = image(path);
+
+        if (size.isValid() && result.size() != size)
+            result = result.scaled(size, mode, Qt::SmoothTransformation);
+
+        if (transform != None)
+            result = result.mirrored(transform & MirrorHorizontal,
+                                     transform & MirrorVertical);
+    }
+    else
+    {
+        result = QImage(path);
+    }
+
+    result = result.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    if (!file.isEmpty() && !result.isNull())
+        writeDisk(file, result);
+
+    insert(key, result);
+
+    return result;
+}
+
+QImage AssetCache::text(const QString& text, const QFont& font, const QColor& color)
+{
+    Key key = {text + QLatin1Char('\0') + font.key(), QSize(), 0, 0, color.rgba()};
+
+    QImage result;
+    if (lookup(key, result))
+        return result;
+
+    QFontMetrics metrics(font);
+    QRect bounds = metrics.boundingRect(text);
+
+    result = QImage(bounds.size(), QImage::Format_ARGB32_Premultiplied);
+    result.fill(Qt::transparent);
+
+    /*
+     * Store the baseline offset so the label can be placed like QPainter::drawText().
+     */
+    result.setOffset(bounds.topLeft());
+
+    QPainter painter(&result);
+    painter.setFont(font);
+    painter.setPen(color);
+    painter.drawText(-bounds.topLeft(), text);
+    painter.end();
+
+    insert(key, result);
+
+    return result;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <cstddef>
+#include <list>
+
+/**
+ * @brief The AssetCache class
+ *
+ * Shared cache of decoded and scaled images, and of rasterized text labels.  Everything in
+ * the cache is stored premultiplied, ready to be blended, so repaints never decode or
+ * smooth-scale an asset once it has been used at a given size.
+ *
+ * The least recently used entries are evicted when the cache goes over its memory limit.
+ *
+ * The cache may be used from the render worker, so lookups and inserts are serialized.
+ * Decoding and scaling a missing entry is done outside of the lock, and a thread asking for
+ * an entry that another thread is creating waits for it instead of creating it again.
+ *
+ * Scaled images that are preloaded can also be kept on disk, so they are only scaled once
+ * across runs.
+ */
+class AssetCache
+{
+public:
+
+    /**
+     * @brief Transform applied to an image after it is scaled.
+     */
+    enum Transform
+    {
+        None = 0,
+        MirrorHorizontal = 1 << 0,
+        MirrorVertical = 1 << 1,
+    };
+
+    /**
+     * @brief The cache shared by the application.
+     */
+    static AssetCache& instance();
+
+    /**
+     * @brief Get an image scaled to fit in size.
+     * @param path File or resource path of the image.
+     * @param size Target size, or an invalid size for the image as decoded.
+     * @param mode
+     * @param transform Combination of Transform flags.
+     * @return
+     */
+    QImage image(const QString& path, const QSize& size = QSize(),
+                 Qt::AspectRatioMode mode = Qt::KeepAspectRatio,
+                 int transform = None);
+
+    /**
+     * @brief Create an image() entry on a thread pool, ahead of its first use.
+     *
+     * A later image() call with the same arguments is a hit, or waits for the entry if it is
+     * still being created.  Only preloaded images go through the disk cache.
+     */
+    void preload(const QString& path, const QSize& size = QSize(),
+                 Qt::AspectRatioMode mode = Qt::KeepAspectRatio,
+                 int transform = None);
+
+    /**
+     * @brief Wait for every preload() to be done.
+     */
+    void waitForPreload();
+
+    /**
+     * @brief Keep scaled images in a directory, to reuse them on the next start.
+     *
+     * Files are named after the hash of the asset file contents and the scaled size, so an
+     * asset that changes is scaled again.  The set of files is bounded by the assets given
+     * to preload() at startup, misses at runtime are only kept in memory.
+     *
+     * @param dir Directory, created if needed, or empty to not use a disk cache.
+     */
+    void setDiskCache(const QString& dir);
+
+    /**
+     * @brief Get a text label rendered on a transparent background.
+     * @param text
+     * @param font
+     * @param color
+     * @return
+     */
+    QImage text(const QString& text, const QFont& font, const QColor& color);
+
+    /**
+     * @brief Set the maximum number of bytes held by the cache.
+     */
+    void setLimit(size_t bytes);
+
+    size_t size() const
+    {
+        return m_bytes;
+    }
+
+    unsigned long hits() const
+    {
+        return m_hits;
+    }
+
+    unsigned long misses() const
+    {
+        return m_misses;
+    }
+
+    /**
+     * @brief Number of misses served by the disk cache instead of scaling.
+     */
+    unsigned long diskHits() const
+    {
+        return m_diskHits;
+    }
+
+    struct Key
+    {
+        QString name;
+        QSize size;
+        int mode;
+        int transform;
+        QRgb color;
+
+        bool operator==(const Key& rhs) const
+        {
+            return name == rhs.name && size == rhs.size && mode == rhs.mode &&
+                transform == rhs.transform && color == rhs.color;
+        }
+    };
+
+protected:
+
+    AssetCache(size_t limit = 8 * 1024 * 1024);
+
+    bool lookup(const Key& key, QImage& image);
+    void insert(const Key& key, const QImage& image);
+    void trim(size_t keep);
+
+    /**
+     * @brief Look up an entry, waiting if another thread is creating it.
+     *
+     * On a miss, the caller must create the entry and insert() it.
+     */
+    bool claim(const Key& key, QImage& image);
+
+    /**
+     * @brief Create or look up an image() entry.
+     * @param disk Read and write the scaled image in the disk cache.
+     */
+    QImage load(const QString& path, const QSize& size, Qt::AspectRatioMode mode,
+                int transform, bool disk);
+
+    QString diskPath(const QString& dir, const Key& key);
+    bool readDisk(const QString& file, QImage& image);
+    void writeDisk(const QString& file, const QImage& image);
+
+    struct Entry
+    {
+        Key key;
+        QImage image;
+    };
+
+    /**
+     * @brief Entries, most recently used first.
+     */
+    std::list<Entry> m_entries;
+    QHash<Key, std::list<Entry>::iterator> m_index;
+    QMutex m_lock;
+
+    /**
+     * @brief Entries being created, and signaled when one is inserted.
+     */
+    QSet<Key> m_loading;
+    QWaitCondition m_loaded;
+
+    QThreadPool m_pool;
+    QString m_disk;
+
+    /**
+     * @brief Hash of the contents of each asset file, computed once.
+     */
+    QHash<QString, QString> m_hashes;
+
+    size_t m_limit;
+    size_t m_bytes;
+    unsigned long m_hits;
+    unsigned long m_misses;
+    unsigned long m_diskHits;
+};
+
+uint qHash(const AssetCache::Key& key, uint seed = 0);
+
+#endif // ASSETCACHE_H
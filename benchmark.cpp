@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "benchmark.h"
+#include "cpusampler.h"
+#include "graphicsplaneitem.h"
+#include "planemanager.h"
+#include <cjson/cJSON.h>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QGraphicsItem>
+#include <QGraphicsView>
+#include <QMouseEvent>
+#include <QTimer>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#if defined(COUNT_ALLOCATIONS) && defined(__GLIBC__)
+/*
+ * Count allocations by interposing the malloc family of the C library.  This catches Qt
+ * containers and images as well, which only use malloc.
+ *
+ * The wrappers replace malloc for the whole process, so they are only built in with
+ * COUNT_ALLOCATIONS, set by "qmake CONFIG+=count_allocations".
+ */
+static std::atomic<unsigned long> allocations(0);
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+unsigned long allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+bool allocationsCounted()
+{
+    return true;
+}
+#else
+unsigned long allocationCount()
+{
+    return 0;
+}
+
+bool allocationsCounted()
+{
+    return false;
+}
+#endif
+
+Benchmark::Benchmark(QGraphicsView* view, PlaneManager& planes)
+    : m_view(view),
+      m_planes(planes),
+      m_rate(60),
+      m_recordItem(0)
+{
+    if (!view)
+        qFatal("invalid view pointer");
+
+    synthesize();
+}
+
+bool Benchmark::load(const QString& filename)
+{
+    std::ifstream in(filename.toStdString());
+    if (!in.is_open())
+        return false;
+
+    std::stringstream ss;
+    ss << in.rdbuf();
+
+    cJSON* root = cJSON_Parse(ss.str().c_str());
+    if (!root)
+    {
+        qDebug() << "failed to parse " << filename;
+        return false;
+    }
+
+    cJSON* rate = cJSON_GetObjectItem(root, "rate");
+    if (rate && rate->valueint > 0)
+        m_rate = rate->valueint;
+
+    m_steps.clear();
+
+    cJSON* steps = cJSON_GetObjectItem(root, "steps");
+    for (int i = 0; steps && i < cJSON_GetArraySize(steps); i++)
+    {
+        cJSON* s = cJSON_GetArrayItem(steps, i);
+        cJSON* type = cJSON_GetObjectItem(s, "type");
+        if (!type || !type->valuestring)
+            continue;
+
+        Step step;
+        step.scale = 1.0;
+
+        std::string t = type->valuestring;
+        if (t == "press")
+            step.type = Step::Press;
+        else if (t == "move")
+            step.type = Step::Move;
+        else if (t == "release")
+            step.type = Step::Release;
+        else if (t == "pinch")
+            step.type = Step::Pinch;
+        else if (t == "hold")
+            step.type = Step::Hold;
+        else if (t == "wait")
+            step.type = Step::Wait;
+        else
+        {
+            qDebug() << "unknown step " << type->valuestring;
+            continue;
+        }
+
+        cJSON* x = cJSON_GetObjectItem(s, "x");
+        cJSON* y = cJSON_GetObjectItem(s, "y");
+        cJSON* scale = cJSON_GetObjectItem(s, "scale");
+        step.pos = QPointF(x ? x->valuedouble : 0, y ? y->valuedouble : 0);
+        if (scale)
+            step.scale = scale->valuedouble;
+
+        m_steps.push_back(step);
+    }
+
+    cJSON_Delete(root);
+
+    return true;
+}
+
+void Benchmark::synthesize()
+{
+    m_steps.clear();
+
+    auto add = [this](Step::Type type, qreal x = 0, qreal y = 0, qreal scale = 1.0) {
+        Step step;
+        step.type = type;
+        step.pos = QPointF(x, y);
+        step.scale = scale;
+        m_steps.push_back(step);
+    };
+
+    static const int STEPS = 120;
+
+    // drag the item around a circle
+    add(Step::Press, 0.5, 0.5);
+    for (int i = 1; i <= STEPS; i++)
+    {
+        qreal a = 2 * M_PI * i / STEPS;
+        add(Step::Move, 0.5 + 0.5 * std::sin(a), 0.5 - 0.5 * (1 - std::cos(a)));
+    }
+    add(Step::Release);
+
+    // grow with the grip and shrink back
+    add(Step::Press, 0.97, 0.97);
+    for (int i = 1; i <= STEPS / 2; i++)
+        add(Step::Move, 0.97 + 0.3 * i / (STEPS / 2), 0.97 + 0.3 * i / (STEPS / 2));
+    for (int i = STEPS / 2 - 1; i >= 0; i--)
+        add(Step::Move, 0.97 + 0.3 * i / (STEPS / 2), 0.97 + 0.3 * i / (STEPS / 2));
+    add(Step::Release);
+
+    // pinch in and out
+    for (int i = 0; i <= STEPS; i++)
+        add(Step::Pinch, 0, 0, 1.0 + 0.5 * std::sin(M_PI * i / STEPS));
+
+    // tap-and-hold puts everything back
+    add(Step::Hold);
+    for (int i = 0; i < 10; i++)
+        add(Step::Wait);
+}
+
+void Benchmark::record(const QString& filename)
+{
+    m_recordFile = filename;
+    m_steps.clear();
+    m_view->viewport()->installEventFilter(this);
+}
+
+bool Benchmark::eventFilter(QObject* object, QEvent* event)
+{
+    Q_UNUSED(object);
+
+    if (event->type() != QEvent::MouseButtonPress &&
+        event->type() != QEvent::MouseMove &&
+        event->type() != QEvent::MouseButtonRelease)
+        return false;
+
+    QMouseEvent* e = static_cast<QMouseEvent*>(event);
+    QPointF scenePos = m_view->mapToScene(e->pos());
+
+    Step step;
+    step.scale = 1.0;
+
+    if (event->type() == QEvent::MouseButtonPress)
+    {
+        m_recordItem = m_view->scene()->itemAt(scenePos, m_view->transform());
+        if (!m_recordItem)
+            return false;
+        m_origin = m_recordItem->sceneBoundingRect();
+        step.type = Step::Press;
+    }
+    else if (!m_recordItem)
+    {
+        return false;
+    }
+    else
+    {
+        step.type = event->type() == QEvent::MouseMove ? Step::Move : Step::Release;
+        if (step.type == Step::Release)
+            m_recordItem = 0;
+    }
+
+    step.pos = QPointF((scenePos.x() - m_origin.x()) / m_origin.width(),
+                       (scenePos.y() - m_origin.y()) / m_origin.height());
+    m_steps.push_back(step);
+
+    return false;
+}
+
+void Benchmark::mouse(QEvent::Type type, const QPointF& pos, Qt::MouseButtons buttons)
+{
+    QPointF local = m_view->mapFromScene(pos);
+    Qt::MouseButton button = type == QEvent::MouseMove ? Qt::NoButton : Qt::LeftButton;
+
+    QMouseEvent event(type, local, m_view->viewport()->mapToGlobal(local.toPoint()),
+                      button, buttons, Qt::NoModifier);
+    QCoreApplication::sendEvent(m_view->viewport(), &event);
+}
+
+void Benchmark::deliver(const Step& step, QGraphicsItem* item)
+{
+    QPointF pos(m_origin.x() + step.pos.x() * m_origin.width(),
+                m_origin.y() + step.pos.y() * m_origin.height());
+
+    switch (step.type)
+    {
+    case Step::Press:
+        m_origin = item->sceneBoundingRect();
+        pos = QPointF(m_origin.x() + step.pos.x() * m_origin.width(),
+                      m_origin.y() + step.pos.y() * m_origin.height());
+        mouse(QEvent::MouseButtonPress, pos, Qt::LeftButton);
+        break;
+    case Step::Move:
+        mouse(QEvent::MouseMove, pos, Qt::LeftButton);
+        break;
+    case Step::Release:
+        mouse(QEvent::MouseButtonRelease, pos, Qt::NoButton);
+        break;
+    case Step::Pinch:
+        item->setScale(step.scale);
+        break;
+    case Step::Hold:
+        if (m_reset)
+            m_reset();
+        break;
+    case Step::Wait:
+        break;
+    }
+}
+
+void Benchmark::run(const QString& name, QGraphicsItem* item)
+{
+    if (m_reset)
+        m_reset();
+
+    // settle whatever the reset queued
+    QCoreApplication::processEvents();
+
+    Result r;
+    r.name = name;
+    r.events = m_steps.size();
+    r.onPlane = false;
+    r.frameMs.reserve(m_steps.size());
+
+    // the allocator may move a plane item to Qt compositing while it runs
+    GraphicsPlaneItem* planeItem = dynamic_cast<GraphicsPlaneItem*>(item);
+    bool composited = !planeItem;
+
+    qint64 period = 1000000000LL / std::max(1, m_rate);
+
+    unsigned long allocations = allocationCount();
+    unsigned long commits = m_planes.commitCount();
+    unsigned long poolHits = m_planes.poolHits();
+    unsigned long poolMisses = m_planes.poolMisses();
+    double cpu = cpuMs();
+
+    QElapsedTimer clock;
+    clock.start();
+
+    qint64 next = 0;
+    for (auto& step: m_steps)
+    {
+        /*
+         * Hold the fixed rate.  Sleep in the event loop until the step is due, so the wait
+         * neither spins nor counts as CPU time of the run.
+         */
+        while (clock.nsecsElapsed() < next)
+        {
+            int remaining = (next - clock.nsecsElapsed() + 999999) / 1000000;
+            QEventLoop loop;
+            QTimer::singleShot(remaining, Qt::PreciseTimer, &loop, &QEventLoop::quit);
+            loop.exec();
+        }
+        next += period;
+
+        /*
+         * A frame is the event and everything it queued: the deferred plane commit, or
+         * the update request that paints and flushes the software view.
+         */
+        qint64 start = clock.nsecsElapsed();
+        deliver(step, item);
+        QCoreApplication::processEvents();
+        r.frameMs.push_back((clock.nsecsElapsed() - start) / 1000000.0);
+
+        if (planeItem && !planeItem->plane())
+            composited = true;
+    }
+
+    r.wallMs = clock.nsecsElapsed() / 1000000.0;
+    r.cpuMs = cpuMs() - cpu;
+    r.allocations = allocationCount() - allocations;
+    r.commits = m_planes.commitCount() - commits;
+    r.poolHits = m_planes.poolHits() - poolHits;
+    r.poolMisses = m_planes.poolMisses() - poolMisses;
+    r.onPlane = !composited;
+
+    if (planeItem && composited)
+        qWarning() << name << "fell back to Qt compositing, results are not for a plane";
+
+    m_results.push_back(r);
+}
+
+std::string Benchmark::report() const
+{
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "rate", m_rate);
+    cJSON_AddNumberToObject(root, "steps", m_steps.size());
+
+    cJSON* items = cJSON_CreateObject();
+    for (auto& r: m_results)
+    {
+        std::vector<double> frames = r.frameMs;
+        std::sort(frames.begin(), frames.end());
+        auto percentile = [&frames](double p) {
+            if (frames.empty())
+                return 0.0;
+            size_t i = std::min(frames.size() - 1, (size_t)(p / 100.0 * frames.size()));
+            return frames[i];
+        };
+
+        cJSON* o = cJSON_CreateObject();
+        cJSON_AddNumberToObject(o, "events", r.events);
+        cJSON_AddNumberToObject(o, "wall_ms", r.wallMs);
+        cJSON_AddNumberToObject(o, "cpu_ms", r.cpuMs);
+        cJSON_AddNumberToObject(o, "cpu_percent", r.wallMs > 0 ? r.cpuMs * 100.0 / r.wallMs : 0);
+        // null rather than 0 when the build does not count them
+        if (allocationsCounted())
+            cJSON_AddNumberToObject(o, "allocations", r.allocations);
+        else
+            cJSON_AddNullToObject(o, "allocations");
+        cJSON_AddNumberToObject(o, "commits", r.commits);
+        cJSON_AddNumberToObject(o, "pool_hits", r.poolHits);
+        cJSON_AddNumberToObject(o, "pool_misses", r.poolMisses);
+        cJSON_AddBoolToObject(o, "on_plane", r.onPlane);
+
+        cJSON* f = cJSON_CreateObject();
+        cJSON_AddNumberToObject(f, "p50", percentile(50));
+        cJSON_AddNumberToObject(f, "p95", percentile(95));
+        cJSON_AddNumberToObject(f, "p99", percentile(99));
+        cJSON_AddNumberToObject(f, "max", frames.empty() ? 0 : frames.back());
+        cJSON_AddItemToObject(o, "frame_ms", f);
+
+        cJSON_AddItemToObject(items, r.name.toUtf8().constData(), o);
+    }
+    cJSON_AddItemToObject(root, "items", items);
+
+    char* text = cJSON_Print(root);
+    std::string result(text ? text : "{}");
+    free(text);
+    cJSON_Delete(root);
+
+    return result;
+}
+
+Benchmark::~Benchmark()
+{
+    if (m_recordFile.isEmpty())
+        return;
+
+    static const char* names[] = { "press", "move", "release", "pinch", "hold", "wait" };
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "rate", m_rate);
+
+    cJSON* steps = cJSON_CreateArray();
+    for (auto& step: m_steps)
+    {
+        cJSON* s = cJSON_CreateObject();
+        cJSON_AddStringToObject(s, "type", names[step.type]);
+        if (step.type == Step::Press || step.type == Step::Move || step.type == Step::Release)
+        {
+            cJSON_AddNumberToObject(s, "x", step.pos.x());
+            cJSON_AddNumberToObject(s, "y", step.pos.y());
+        }
+        else if (step.type == Step::Pinch)
+        {
+            cJSON_AddNumberToObject(s, "scale", step.scale);
+        }
+        cJSON_AddItemToArray(steps, s);
+    }
+    cJSON_AddItemToObject(root, "steps", steps);
+
+    char* text = cJSON_Print(root);
+    if (text)
+    {
+        std::ofstream out(m_recordFile.toStdString());
+        out << text << std::endl;
+        free(text);
+    }
+    cJSON_Delete(root);
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QEvent>
+#include <QObject>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+#include <functional>
+#include <string>
+#include <vector>
+
+class PlaneManager;
+class QGraphicsItem;
+class QGraphicsView;
+
+/**
+ * @brief The Benchmark class
+ *
+ * Replays a gesture script against scene items at a fixed event rate, and reports what it
+ * cost for each item.
+ *
+ * A script is a JSON file:
+ *
+ *     { "rate": 60,
+ *       "steps": [ { "type": "press", "x": 0.5, "y": 0.5 },
+ *                  { "type": "move", "x": 0.6, "y": 0.5 },
+ *                  { "type": "release" },
+ *                  { "type": "pinch", "scale": 1.2 },
+ *                  { "type": "hold" },
+ *                  { "type": "wait" } ] }
+ *
+ * Positions are relative to the bounding rect of the item when the last press happened,
+ * 0 to 1 from its top left to its bottom right, so a script replays the same on items of
+ * any size and position.  Mouse events go through the viewport like real input.  A pinch
+ * sets the item scale the way the pinch gesture handler does, and a hold runs the
+ * tap-and-hold action.
+ *
+ * Scripts are recorded with record(), or synthesize() builds a drag, a grip resize, a
+ * pinch and a tap-and-hold.
+ */
+class Benchmark : public QObject
+{
+public:
+
+    struct Step
+    {
+        enum Type
+        {
+            Press,
+            Move,
+            Release,
+            Pinch,
+            Hold,
+            Wait,
+        };
+
+        Type type;
+        QPointF pos;
+        qreal scale;
+    };
+
+    Benchmark(QGraphicsView* view, PlaneManager& planes);
+
+    /**
+     * @brief Load a script.
+     * @return false if the file can't be read or parsed.
+     */
+    bool load(const QString& filename);
+
+    /**
+     * @brief Replace the script with the built in gestures.
+     */
+    void synthesize();
+
+    /**
+     * @brief Record mouse input on the view into a script, saved when the object is destroyed.
+     */
+    void record(const QString& filename);
+
+    /**
+     * @brief Events per second, overrides the rate of a loaded script.
+     */
+    void setRate(int rate)
+    {
+        m_rate = rate;
+    }
+
+    /**
+     * @brief Called before the script runs on each item, and for hold steps.
+     */
+    void setReset(const std::function<void()>& reset)
+    {
+        m_reset = reset;
+    }
+
+    /**
+     * @brief Run the script against an item.
+     *
+     * A GraphicsPlaneItem that is composited by Qt during any step of the run is reported
+     * as not on a plane, with a warning.
+     *
+     * @param name Name of the item in the report.
+     * @param item
+     */
+    void run(const QString& name, QGraphicsItem* item);
+
+    /**
+     * @brief Results of all runs, as a JSON object.
+     */
+    std::string report() const;
+
+    virtual ~Benchmark();
+
+protected:
+
+    virtual bool eventFilter(QObject* object, QEvent* event) override;
+
+    void deliver(const Step& step, QGraphicsItem* item);
+    void mouse(QEvent::Type type, const QPointF& pos, Qt::MouseButtons buttons);
+
+    struct Result
+    {
+        QString name;
+        unsigned long events;
+        double wallMs;
+        double cpuMs;
+        unsigned long allocations;
+        unsigned long commits;
+        unsigned long poolHits;
+        unsigned long poolMisses;
+        bool onPlane;
+        std::vector<double> frameMs;
+    };
+
+    QGraphicsView* m_view;
+    PlaneManager& m_planes;
+    std::vector<Step> m_steps;
+    int m_rate;
+    std::function<void()> m_reset;
+    std::vector<Result> m_results;
+
+    /**
+     * @brief Bounding rect in scene coordinates of the item at the last press.
+     */
+    QRectF m_origin;
+
+    QString m_recordFile;
+    QGraphicsItem* m_recordItem;
+};
+
+/**
+ * @brief Number of heap allocations made by the process so far.
+ *
+ * Only counted with glibc when built with COUNT_ALLOCATIONS, 0 otherwise.
+ */
+unsigned long allocationCount();
+
+/**
+ * @brief Are allocations counted by allocationCount() in this build?
+ */
+bool allocationsCounted();
+
+#endif // BENCHMARK_H
@@ -0,0 +1,995 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "blit.h"
+#include <drm_fourcc.h>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace Blit
+{
+
+/*
+ * Scalar helpers.  The SIMD kernels must match these bit for bit.
+ */
+
+static inline uint32_t red(uint32_t p)
+{
+    return (p >> 16) & 0xff;
+}
+
+static inline uint32_t green(uint32_t p)
+{
+    return (p >> 8) & 0xff;
+}
+
+static inline uint32_t blue(uint32_t p)
+{
+    return p & 0xff;
+}
+
+static inline uint8_t lumaOf(int r, int g, int b)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t cbOf(int r, int g, int b)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t crOf(int r, int g, int b)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline uint16_t toRgb565(uint32_t p)
+{
+    return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+}
+
+static inline uint16_t toArgb4444(uint32_t p)
+{
+    return ((p >> 16) & 0xf000) | ((p >> 12) & 0x0f00) | ((p >> 8) & 0x00f0) | ((p >> 4) & 0x000f);
+}
+
+/*
+ * Row functions.  Each converts width pixels of one line, and the SIMD versions finish the
+ * tail of a line with the scalar version.
+ */
+
+typedef void (*RowFunction)(const uint32_t* src, uchar* dst, int width);
+
+static void rowCopy(const uint32_t* src, uchar* dst, int width)
+{
+    memcpy(dst, src, width * 4);
+}
+
+static void rowXrgbScalar(const uint32_t* src, uchar* dst, int width)
+{
+    uint32_t* d = reinterpret_cast<uint32_t*>(dst);
+    for (int x = 0; x < width; x++)
+        d[x] = src[x] | 0xff000000;
+}
+
+static void rowRgb565Scalar(const uint32_t* src, uchar* dst, int width)
+{
+    uint16_t* d = reinterpret_cast<uint16_t*>(dst);
+    for (int x = 0; x < width; x++)
+        d[x] = toRgb565(src[x]);
+}
+
+static void rowArgb4444Scalar(const uint32_t* src, uchar* dst, int width)
+{
+    uint16_t* d = reinterpret_cast<uint16_t*>(dst);
+    for (int x = 0; x < width; x++)
+        d[x] = toArgb4444(src[x]);
+}
+
+static void rowLumaScalar(const uint32_t* src, uchar* dst, int width)
+{
+    for (int x = 0; x < width; x++)
+        dst[x] = lumaOf(red(src[x]), green(src[x]), blue(src[x]));
+}
+
+static void rowYuyvScalar(const uint32_t* src, uchar* dst, int width)
+{
+    for (int x = 0; x < width; x += 2)
+    {
+        int x1 = std::min(x + 1, width - 1);
+        int r = (red(src[x]) + red(src[x1]) + 1) >> 1;
+        int g = (green(src[x]) + green(src[x1]) + 1) >> 1;
+        int b = (blue(src[x]) + blue(src[x1]) + 1) >> 1;
+
+        dst[x * 2] = lumaOf(red(src[x]), green(src[x]), blue(src[x]));
+        dst[x * 2 + 1] = cbOf(r, g, b);
+        if (x + 1 < width)
+            dst[x * 2 + 2] = lumaOf(red(src[x1]), green(src[x1]), blue(src[x1]));
+        dst[x * 2 + 3] = crOf(r, g, b);
+    }
+}
+
+/*
+ * Chroma row functions.  Each averages the 2x2 blocks of two lines into width / 2 CbCr
+ * pairs, an odd last column or line being repeated by the caller.
+ */
+
+typedef void (*ChromaFunction)(const uint32_t* s0, const uint32_t* s1, uchar* dst, int width);
+
+static void rowCbCrScalar(const uint32_t* s0, const uint32_t* s1, uchar* dst, int width)
+{
+    for (int x = 0; x < width; x += 2)
+    {
+        int x1 = std::min(x + 1, width - 1);
+        int r = (red(s0[x]) + red(s0[x1]) + red(s1[x]) + red(s1[x1]) + 2) >> 2;
+        int g = (green(s0[x]) + green(s0[x1]) + green(s1[x]) + green(s1[x1]) + 2) >> 2;
+        int b = (blue(s0[x]) + blue(s0[x1]) + blue(s1[x]) + blue(s1[x1]) + 2) >> 2;
+        dst[x] = cbOf(r, g, b);
+        dst[x + 1] = crOf(r, g, b);
+    }
+}
+
+#ifdef HAVE_SSE2
+static void rowXrgbSse2(const uint32_t* src, uchar* dst, int width)
+{
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_or_si128(p, alpha));
+    }
+    rowXrgbScalar(src + x, dst + x * 4, width - x);
+}
+
+/*
+ * Pack the low 16 bits of each 32 bit lane.  _mm_packs_epi32() saturates, so sign extend
+ * the low half first to make it an exact truncation.
+ */
+static inline __m128i pack16(__m128i a, __m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    return _mm_packs_epi32(a, b);
+}
+
+static inline __m128i rgb565Sse2(__m128i p)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static void rowRgb565Sse2(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2),
+                         pack16(rgb565Sse2(a), rgb565Sse2(b)));
+    }
+    rowRgb565Scalar(src + x, dst + x * 2, width - x);
+}
+
+static inline __m128i argb4444Sse2(__m128i p)
+{
+    __m128i a = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xf000));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 12), _mm_set1_epi32(0x0f00));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0x00f0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 4), _mm_set1_epi32(0x000f));
+    return _mm_or_si128(_mm_or_si128(a, r), _mm_or_si128(g, b));
+}
+
+static void rowArgb4444Sse2(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2),
+                         pack16(argb4444Sse2(a), argb4444Sse2(b)));
+    }
+    rowArgb4444Scalar(src + x, dst + x * 2, width - x);
+}
+
+/*
+ * Luma of four pixels, one in each 32 bit lane.
+ */
+static inline __m128i lumaSse2(__m128i p)
+{
+    /*
+     * Each 32 bit lane holds one channel value in its low 16 bits, so _mm_mullo_epi16()
+     * gives the exact product.  The largest sum, 220 * 255 + 128, fits easily.
+     */
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+    __m128i b = _mm_and_si128(p, mask);
+
+    __m128i y = _mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(66)),
+                              _mm_mullo_epi16(g, _mm_set1_epi32(129)));
+    y = _mm_add_epi32(y, _mm_add_epi32(_mm_mullo_epi16(b, _mm_set1_epi32(25)),
+                                       _mm_set1_epi32(128)));
+    return _mm_add_epi32(_mm_srli_epi32(y, 8), _mm_set1_epi32(16));
+}
+
+/*
+ * Cb and Cr of two averaged pixels, given as 16 bit b, g, r, a lanes.  The results are in
+ * 32 bit lanes 0 and 2.
+ *
+ * _mm_madd_epi16() sums the b, g and r, a products into 32 bit lanes, then the odd lane is
+ * added to the even one, so the arithmetic is the same signed int as the scalar version.
+ */
+static inline void chromaSse2(__m128i bgra, __m128i& cb, __m128i& cr)
+{
+    const __m128i round = _mm_set1_epi32(128);
+
+    cb = _mm_madd_epi16(bgra, _mm_set_epi16(0, -38, -74, 112, 0, -38, -74, 112));
+    cb = _mm_add_epi32(cb, _mm_srli_epi64(cb, 32));
+    cb = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(cb, round), 8), round);
+
+    cr = _mm_madd_epi16(bgra, _mm_set_epi16(0, 112, -94, -18, 0, 112, -94, -18));
+    cr = _mm_add_epi32(cr, _mm_srli_epi64(cr, 32));
+    cr = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(cr, round), 8), round);
+}
+
+static void rowLumaSse2(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i y = lumaSse2(p);
+
+        y = _mm_packs_epi32(y, y);
+        y = _mm_packus_epi16(y, y);
+        int v = _mm_cvtsi128_si32(y);
+        memcpy(dst + x, &v, 4);
+    }
+    rowLumaScalar(src + x, dst + x, width - x);
+}
+
+static void rowYuyvSse2(const uint32_t* src, uchar* dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+
+        // widen to 16 bit lanes and line up the pixels of each pair
+        __m128i lo = _mm_unpacklo_epi8(p, zero);
+        __m128i hi = _mm_unpackhi_epi8(p, zero);
+        __m128i avg = _mm_avg_epu16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+
+        __m128i cb, cr;
+        chromaSse2(avg, cb, cr);
+
+        __m128i y = lumaSse2(p);
+        __m128i d = _mm_or_si128(y, _mm_slli_epi32(cb, 8));
+        d = _mm_or_si128(d, _mm_slli_epi32(_mm_srli_epi64(y, 32), 16));
+        d = _mm_or_si128(d, _mm_slli_epi32(cr, 24));
+
+        d = _mm_shuffle_epi32(d, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 2), d);
+    }
+    rowYuyvScalar(src + x, dst + x * 2, width - x);
+}
+
+static void rowCbCrSse2(const uint32_t* s0, const uint32_t* s1, uchar* dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + x));
+        __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + x));
+
+        // vertical sums, then the pixels of each pair added
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(p1, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(p1, zero));
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+        __m128i avg = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+
+        __m128i cb, cr;
+        chromaSse2(avg, cb, cr);
+
+        __m128i d = _mm_or_si128(cb, _mm_slli_epi32(cr, 8));
+        d = _mm_shuffle_epi32(d, _MM_SHUFFLE(3, 1, 2, 0));
+        d = pack16(d, d);
+        int v = _mm_cvtsi128_si32(d);
+        memcpy(dst + x, &v, 4);
+    }
+    rowCbCrScalar(s0 + x, s1 + x, dst + x, width - x);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void rowXrgbNeon(const uint32_t* src, uchar* dst, int width)
+{
+    const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+        vst1q_u32(reinterpret_cast<uint32_t*>(dst + x * 4), vorrq_u32(vld1q_u32(src + x), alpha));
+    rowXrgbScalar(src + x, dst + x * 4, width - x);
+}
+
+static void rowRgb565Neon(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        // lanes are b, g, r, a in memory order
+        uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t*>(src + x));
+        uint16x8_t d = vshll_n_u8(p.val[2], 8);
+        d = vsriq_n_u16(d, vshll_n_u8(p.val[1], 8), 5);
+        d = vsriq_n_u16(d, vshll_n_u8(p.val[0], 8), 11);
+        vst1q_u16(reinterpret_cast<uint16_t*>(dst + x * 2), d);
+    }
+    rowRgb565Scalar(src + x, dst + x * 2, width - x);
+}
+
+static void rowArgb4444Neon(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t*>(src + x));
+        uint16x8_t d = vshll_n_u8(p.val[3], 8);
+        d = vsriq_n_u16(d, vshll_n_u8(p.val[2], 8), 4);
+        d = vsriq_n_u16(d, vshll_n_u8(p.val[1], 8), 8);
+        d = vsriq_n_u16(d, vshll_n_u8(p.val[0], 8), 12);
+        vst1q_u16(reinterpret_cast<uint16_t*>(dst + x * 2), d);
+    }
+    rowArgb4444Scalar(src + x, dst + x * 2, width - x);
+}
+
+static inline uint8x8_t lumaNeon(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    uint16x8_t y = vmull_u8(r, vdup_n_u8(66));
+    y = vmlal_u8(y, g, vdup_n_u8(129));
+    y = vmlal_u8(y, b, vdup_n_u8(25));
+    y = vaddq_u16(y, vdupq_n_u16(128));
+    return vadd_u8(vshrn_n_u16(y, 8), vdup_n_u8(16));
+}
+
+/*
+ * Cb and Cr of eight averaged pixels.  Every partial sum stays within +-28688, so signed 16
+ * bit lanes give the same result as the scalar int arithmetic.
+ */
+static inline void chromaNeon(uint16x8_t r16, uint16x8_t g16, uint16x8_t b16,
+                              uint8x8_t& cb, uint8x8_t& cr)
+{
+    const int16x8_t round = vdupq_n_s16(128);
+    int16x8_t r = vreinterpretq_s16_u16(r16);
+    int16x8_t g = vreinterpretq_s16_u16(g16);
+    int16x8_t b = vreinterpretq_s16_u16(b16);
+
+    int16x8_t u = vmulq_n_s16(b, 112);
+    u = vmlaq_n_s16(u, g, -74);
+    u = vmlaq_n_s16(u, r, -38);
+    u = vaddq_s16(vshrq_n_s16(vaddq_s16(u, round), 8), round);
+    cb = vmovn_u16(vreinterpretq_u16_s16(u));
+
+    int16x8_t v = vmulq_n_s16(r, 112);
+    v = vmlaq_n_s16(v, g, -94);
+    v = vmlaq_n_s16(v, b, -18);
+    v = vaddq_s16(vshrq_n_s16(vaddq_s16(v, round), 8), round);
+    cr = vmovn_u16(vreinterpretq_u16_s16(v));
+}
+
+static void rowLumaNeon(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t*>(src + x));
+        vst1_u8(dst + x, lumaNeon(p.val[2], p.val[1], p.val[0]));
+    }
+    rowLumaScalar(src + x, dst + x, width - x);
+}
+
+static void rowYuyvNeon(const uint32_t* src, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x4_t p = vld4q_u8(reinterpret_cast<const uint8_t*>(src + x));
+
+        uint8x8_t lo = lumaNeon(vget_low_u8(p.val[2]), vget_low_u8(p.val[1]),
+                                vget_low_u8(p.val[0]));
+        uint8x8_t hi = lumaNeon(vget_high_u8(p.val[2]), vget_high_u8(p.val[1]),
+                                vget_high_u8(p.val[0]));
+        uint8x8x2_t y = vuzp_u8(lo, hi);
+
+        // pairwise sums, rounded halves
+        uint8x8x4_t d;
+        chromaNeon(vrshrq_n_u16(vpaddlq_u8(p.val[2]), 1),
+                   vrshrq_n_u16(vpaddlq_u8(p.val[1]), 1),
+                   vrshrq_n_u16(vpaddlq_u8(p.val[0]), 1),
+                   d.val[1], d.val[3]);
+        d.val[0] = y.val[0];
+        d.val[2] = y.val[1];
+        vst4_u8(dst + x * 2, d);
+    }
+    rowYuyvScalar(src + x, dst + x * 2, width - x);
+}
+
+static void rowCbCrNeon(const uint32_t* s0, const uint32_t* s1, uchar* dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x4_t p0 = vld4q_u8(reinterpret_cast<const uint8_t*>(s0 + x));
+        uint8x16x4_t p1 = vld4q_u8(reinterpret_cast<const uint8_t*>(s1 + x));
+
+        // pairwise sums of both lines, rounded quarters
+        uint8x8x2_t d;
+        chromaNeon(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[2]), p1.val[2]), 2),
+                   vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[1]), p1.val[1]), 2),
+                   vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[0]), p1.val[0]), 2),
+                   d.val[0], d.val[1]);
+        vst2_u8(dst + x, d);
+    }
+    rowCbCrScalar(s0 + x, s1 + x, dst + x, width - x);
+}
+#endif
+
+/*
+ * Kernels.
+ */
+
+template<RowFunction row>
+static void packed(const uchar* src, int srcPitch, uchar* dst, int dstPitch,
+                   uchar* chroma, int chromaPitch, int width, int height)
+{
+    Q_UNUSED(chroma);
+    Q_UNUSED(chromaPitch);
+
+    for (int y = 0; y < height; y++)
+        row(reinterpret_cast<const uint32_t*>(src + y * srcPitch), dst + y * dstPitch, width);
+}
+
+template<RowFunction luma, ChromaFunction cbcr>
+static void nv12(const uchar* src, int srcPitch, uchar* dst, int dstPitch,
+                 uchar* chroma, int chromaPitch, int width, int height)
+{
+    for (int y = 0; y < height; y++)
+        luma(reinterpret_cast<const uint32_t*>(src + y * srcPitch), dst + y * dstPitch, width);
+
+    for (int y = 0; y < height; y += 2)
+    {
+        const uint32_t* s0 = reinterpret_cast<const uint32_t*>(src + y * srcPitch);
+        const uint32_t* s1 = reinterpret_cast<const uint32_t*>(src + std::min(y + 1, height - 1) * srcPitch);
+        cbcr(s0, s1, chroma + (y / 2) * chromaPitch, width);
+    }
+}
+
+Isa bestIsa()
+{
+#if defined(HAVE_NEON)
+#if defined(__aarch64__)
+    return Neon;
+#else
+    static const bool neon = getauxval(AT_HWCAP) & HWCAP_NEON;
+    return neon ? Neon : Scalar;
+#endif
+#elif defined(HAVE_SSE2)
+    return Sse2;
+#else
+    return Scalar;
+#endif
+}
+
+Kernel kernel(uint32_t format, Isa isa)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_ARGB8888:
+        return &packed<rowCopy>;
+    case DRM_FORMAT_XRGB8888:
+#ifdef HAVE_SSE2
+        if (isa == Sse2)
+            return &packed<rowXrgbSse2>;
+#endif
+#ifdef HAVE_NEON
+        if (isa == Neon)
+            return &packed<rowXrgbNeon>;
+#endif
+        return &packed<rowXrgbScalar>;
+    case DRM_FORMAT_RGB565:
+#ifdef HAVE_SSE2
+        if (isa == Sse2)
+            return &packed<rowRgb565Sse2>;
+#endif
+#ifdef HAVE_NEON
+        if (isa == Neon)
+            return &packed<rowRgb565Neon>;
+#endif
+        return &packed<rowRgb565Scalar>;
+    case DRM_FORMAT_ARGB4444:
+#ifdef HAVE_SSE2
+        if (isa == Sse2)
+            return &packed<rowArgb4444Sse2>;
+#endif
+#ifdef HAVE_NEON
+        if (isa == Neon)
+            return &packed<rowArgb4444Neon>;
+#endif
+        return &packed<rowArgb4444Scalar>;
+    case DRM_FORMAT_NV12:
+#ifdef HAVE_SSE2
+        if (isa == Sse2)
+            return &nv12<rowLumaSse2, rowCbCrSse2>;
+#endif
+#ifdef HAVE_NEON
+        if (isa == Neon)
+            return &nv12<rowLumaNeon, rowCbCrNeon>;
+#endif
+        return &nv12<rowLumaScalar, rowCbCrScalar>;
+    case DRM_FORMAT_YUYV:
+#ifdef HAVE_SSE2
+        if (isa == Sse2)
+            return &packed<rowYuyvSse2>;
+#endif
+#ifdef HAVE_NEON
+        if (isa == Neon)
+            return &packed<rowYuyvNeon>;
+#endif
+        return &packed<rowYuyvScalar>;
+    }
+
+    Q_UNUSED(isa);
+
+    return 0;
+}
+
+QImage::Format imageFormat(uint32_t format)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_ARGB8888:
+        return QImage::Format_ARGB32_Premultiplied;
+    case DRM_FORMAT_XRGB8888:
+        return QImage::Format_RGB32;
+    case DRM_FORMAT_RGB565:
+        return QImage::Format_RGB16;
+    case DRM_FORMAT_ARGB4444:
+        return QImage::Format_ARGB4444_Premultiplied;
+    }
+
+    return QImage::Format_Invalid;
+}
+
+uint32_t drmFormat(QImage::Format format)
+{
+    switch (format)
+    {
+    case QImage::Format_ARGB32_Premultiplied:
+        return DRM_FORMAT_ARGB8888;
+    case QImage::Format_RGB32:
+        return DRM_FORMAT_XRGB8888;
+    case QImage::Format_RGB16:
+        return DRM_FORMAT_RGB565;
+    case QImage::Format_ARGB4444_Premultiplied:
+        return DRM_FORMAT_ARGB4444;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int bytesPerPixel(uint32_t format)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_ARGB4444:
+    case DRM_FORMAT_YUYV:
+        return 2;
+    case DRM_FORMAT_NV12:
+        return 1;
+    }
+
+    return 4;
+}
+
+bool convert(uint32_t format, const QImage& src, const QRect& rect,
+             uchar* dst, int pitch, int height)
+{
+    Kernel k = kernel(format);
+    if (!k)
+        return false;
+
+    QImage image = src;
+    if (image.format() != QImage::Format_ARGB32_Premultiplied)
+        image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QRect r = rect & image.rect();
+    if (r.isEmpty())
+        return true;
+
+    /*
+     * Subsampled formats need whole chroma samples.  A sample shared with a pixel outside
+     * of the rect is computed from both pixels, so the rect grows outward to even edges,
+     * except at the edges of the image.
+     */
+    if (format == DRM_FORMAT_NV12 || format == DRM_FORMAT_YUYV)
+    {
+        r.setLeft(r.left() & ~1);
+        if (!(r.right() & 1))
+            r.setRight(std::min(r.right() + 1, image.rect().right()));
+
+        if (format == DRM_FORMAT_NV12)
+        {
+            r.setTop(r.top() & ~1);
+            if (!(r.bottom() & 1))
+                r.setBottom(std::min(r.bottom() + 1, image.rect().bottom()));
+        }
+    }
+
+    uchar* chroma = 0;
+    if (format == DRM_FORMAT_NV12)
+        chroma = dst + pitch * height + (r.top() / 2) * pitch + r.left();
+
+    k(image.constScanLine(r.top()) + r.left() * 4, image.bytesPerLine(),
+      dst + r.top() * pitch + r.left() * bytesPerPixel(format), pitch,
+      chroma, pitch,
+      r.width(), r.height());
+
+    return true;
+}
+
+void copy(uint32_t format, const uchar* src, int srcPitch,
+          uchar* dst, int pitch, int dstHeight, int width, int height)
+{
+    int bytes = width * bytesPerPixel(format);
+
+    for (int y = 0; y < height; y++)
+        memcpy(dst + y * pitch, src + y * srcPitch, bytes);
+
+    if (format == DRM_FORMAT_NV12)
+    {
+        const uchar* chroma = src + height * srcPitch;
+        uchar* out = dst + dstHeight * pitch;
+
+        // interleaved CbCr, a sample pair for every two pixels
+        for (int y = 0; y < height / 2; y++)
+            memcpy(out + y * pitch, chroma + y * srcPitch, width & ~1);
+    }
+}
+
+
+/*
+ * Transforms.
+ *
+ * Reversing a row is done from both ends at once, so a row is mirrored in place.  Vertical
+ * flips swap whole rows, and both flips together swap each row with the reverse of its
+ * opposite row.
+ */
+
+template<typename T>
+static void reverseScalar(T* a, T* b, int width, int done)
+{
+    // a[x] <-> b[width - 1 - x] for x in [done, width), a and b may be the same row
+    int end = (a == b) ? width / 2 : width;
+    for (int x = done; x < end; x++)
+        std::swap(a[x], b[width - 1 - x]);
+}
+
+#ifdef HAVE_SSE2
+static inline __m128i reverse32Sse2(__m128i v)
+{
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static inline __m128i reverse16Sse2(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+#endif
+
+#ifdef HAVE_NEON
+static inline uint32x4_t reverse32Neon(uint32x4_t v)
+{
+    v = vrev64q_u32(v);
+    return vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+}
+
+static inline uint16x8_t reverse16Neon(uint16x8_t v)
+{
+    v = vrev64q_u16(v);
+    return vcombine_u16(vget_high_u16(v), vget_low_u16(v));
+}
+#endif
+
+/**
+ * Swap row a with the reverse of row b.  With a == b, reverse the row in place.
+ */
+static void reverse32(uint32_t* a, uint32_t* b, int width, Isa isa)
+{
+    int x = 0;
+    // in place, vectors from both ends must not meet
+    int end = (a == b) ? width / 2 - 3 : width - 3;
+
+#ifdef HAVE_SSE2
+    if (isa == Sse2)
+    {
+        for (; x < end; x += 4)
+        {
+            __m128i* pa = reinterpret_cast<__m128i*>(a + x);
+            __m128i* pb = reinterpret_cast<__m128i*>(b + width - 4 - x);
+            __m128i va = _mm_loadu_si128(pa);
+            __m128i vb = _mm_loadu_si128(pb);
+            _mm_storeu_si128(pa, reverse32Sse2(vb));
+            _mm_storeu_si128(pb, reverse32Sse2(va));
+        }
+    }
+#endif
+#ifdef HAVE_NEON
+    if (isa == Neon)
+    {
+        for (; x < end; x += 4)
+        {
+            uint32x4_t va = vld1q_u32(a + x);
+            uint32x4_t vb = vld1q_u32(b + width - 4 - x);
+            vst1q_u32(a + x, reverse32Neon(vb));
+            vst1q_u32(b + width - 4 - x, reverse32Neon(va));
+        }
+    }
+#endif
+    Q_UNUSED(end);
+    Q_UNUSED(isa);
+
+    reverseScalar(a, b, width, x);
+}
+
+static void reverse16(uint16_t* a, uint16_t* b, int width, Isa isa)
+{
+    int x = 0;
+    int end = (a == b) ? width / 2 - 7 : width - 7;
+
+#ifdef HAVE_SSE2
+    if (isa == Sse2)
+    {
+        for (; x < end; x += 8)
+        {
+            __m128i* pa = reinterpret_cast<__m128i*>(a + x);
+            __m128i* pb = reinterpret_cast<__m128i*>(b + width - 8 - x);
+            __m128i va = _mm_loadu_si128(pa);
+            __m128i vb = _mm_loadu_si128(pb);
+            _mm_storeu_si128(pa, reverse16Sse2(vb));
+            _mm_storeu_si128(pb, reverse16Sse2(va));
+        }
+    }
+#endif
+#ifdef HAVE_NEON
+    if (isa == Neon)
+    {
+        for (; x < end; x += 8)
+        {
+            uint16x8_t va = vld1q_u16(a + x);
+            uint16x8_t vb = vld1q_u16(b + width - 8 - x);
+            vst1q_u16(a + x, reverse16Neon(vb));
+            vst1q_u16(b + width - 8 - x, reverse16Neon(va));
+        }
+    }
+#endif
+    Q_UNUSED(end);
+    Q_UNUSED(isa);
+
+    reverseScalar(a, b, width, x);
+}
+
+static void reverse(uchar* a, uchar* b, int bpp, int width, Isa isa)
+{
+    if (bpp == 4)
+        reverse32(reinterpret_cast<uint32_t*>(a), reinterpret_cast<uint32_t*>(b), width, isa);
+    else
+        reverse16(reinterpret_cast<uint16_t*>(a), reinterpret_cast<uint16_t*>(b), width, isa);
+}
+
+static void swapRows(uchar* a, uchar* b, int bytes)
+{
+    uchar tmp[256];
+
+    while (bytes > 0)
+    {
+        int n = std::min(bytes, (int)sizeof(tmp));
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+        a += n;
+        b += n;
+        bytes -= n;
+    }
+}
+
+bool mirror(uchar* data, int pitch, int bpp, int width, int height,
+            bool horizontal, bool vertical)
+{
+    if (bpp != 2 && bpp != 4)
+        return false;
+
+    Isa isa = bestIsa();
+
+    if (!vertical)
+    {
+        if (horizontal)
+            for (int y = 0; y < height; y++)
+                reverse(data + y * pitch, data + y * pitch, bpp, width, isa);
+        return true;
+    }
+
+    for (int y = 0; y < height / 2; y++)
+    {
+        uchar* a = data + y * pitch;
+        uchar* b = data + (height - 1 - y) * pitch;
+
+        if (horizontal)
+            reverse(a, b, bpp, width, isa);
+        else
+            swapRows(a, b, width * bpp);
+    }
+
+    // the middle row of an odd height stays in place, but is still mirrored
+    if (horizontal && (height & 1))
+        reverse(data + (height / 2) * pitch, data + (height / 2) * pitch, bpp, width, isa);
+
+    return true;
+}
+
+/*
+ * Transpose a block of 4x4 pixels: line i of the destination gets column i of the source,
+ * from its first line on.  Pitches may be negative to walk the lines upwards, which turns
+ * the transpose into a rotation.
+ */
+
+static void transpose4Scalar(const uchar* src, int srcPitch, uchar* dst, int dstPitch)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t* d = reinterpret_cast<uint32_t*>(dst + i * dstPitch);
+        for (int k = 0; k < 4; k++)
+            d[k] = reinterpret_cast<const uint32_t*>(src + k * srcPitch)[i];
+    }
+}
+
+#ifdef HAVE_SSE2
+static void transpose4Sse2(const uchar* src, int srcPitch, uchar* dst, int dstPitch)
+{
+    __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + srcPitch));
+    __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * srcPitch));
+    __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * srcPitch));
+
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dstPitch), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * dstPitch), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * dstPitch), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+#ifdef HAVE_NEON
+static void transpose4Neon(const uchar* src, int srcPitch, uchar* dst, int dstPitch)
+{
+    uint32x4_t r0 = vld1q_u32(reinterpret_cast<const uint32_t*>(src));
+    uint32x4_t r1 = vld1q_u32(reinterpret_cast<const uint32_t*>(src + srcPitch));
+    uint32x4_t r2 = vld1q_u32(reinterpret_cast<const uint32_t*>(src + 2 * srcPitch));
+    uint32x4_t r3 = vld1q_u32(reinterpret_cast<const uint32_t*>(src + 3 * srcPitch));
+
+    uint32x4x2_t a = vtrnq_u32(r0, r1);
+    uint32x4x2_t b = vtrnq_u32(r2, r3);
+
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst),
+              vcombine_u32(vget_low_u32(a.val[0]), vget_low_u32(b.val[0])));
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst + dstPitch),
+              vcombine_u32(vget_low_u32(a.val[1]), vget_low_u32(b.val[1])));
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst + 2 * dstPitch),
+              vcombine_u32(vget_high_u32(a.val[0]), vget_high_u32(b.val[0])));
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst + 3 * dstPitch),
+              vcombine_u32(vget_high_u32(a.val[1]), vget_high_u32(b.val[1])));
+}
+#endif
+
+typedef void (*TransposeFunction)(const uchar* src, int srcPitch, uchar* dst, int dstPitch);
+
+static void rotateScalar(const uchar* src, int srcPitch, uchar* dst, int dstPitch,
+                         int width, int height, bool clockwise, int x0, int x1, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        const uint32_t* s = reinterpret_cast<const uint32_t*>(src + y * srcPitch);
+
+        for (int x = x0; x < x1; x++)
+        {
+            // source (x, y) lands at (height - 1 - y, x) clockwise, (y, width - 1 - x) otherwise
+            int dx = clockwise ? height - 1 - y : y;
+            int dy = clockwise ? x : width - 1 - x;
+            reinterpret_cast<uint32_t*>(dst + dy * dstPitch)[dx] = s[x];
+        }
+    }
+}
+
+void rotate(const uchar* src, int srcPitch, uchar* dst, int dstPitch,
+            int width, int height, bool clockwise)
+{
+    TransposeFunction transpose = &transpose4Scalar;
+#ifdef HAVE_SSE2
+    if (bestIsa() == Sse2)
+        transpose = &transpose4Sse2;
+#endif
+#ifdef HAVE_NEON
+    if (bestIsa() == Neon)
+        transpose = &transpose4Neon;
+#endif
+
+    /*
+     * Work in tiles so both the rows read and the columns written stay in cache, and
+     * within a tile in 4x4 blocks.  Clockwise, the source lines of a block are read bottom
+     * up, otherwise the destination lines are written bottom up.
+     */
+    static const int TILE = 32;
+
+    for (int ty = 0; ty < height; ty += TILE)
+    {
+        int th = std::min(TILE, height - ty);
+
+        for (int tx = 0; tx < width; tx += TILE)
+        {
+            int tw = std::min(TILE, width - tx);
+
+            int y = ty;
+            for (; y + 4 <= ty + th; y += 4)
+            {
+                int x = tx;
+                for (; x + 4 <= tx + tw; x += 4)
+                {
+                    if (clockwise)
+                        transpose(src + (y + 3) * srcPitch + x * 4, -srcPitch,
+                                  dst + x * dstPitch + (height - 4 - y) * 4, dstPitch);
+                    else
+                        transpose(src + y * srcPitch + x * 4, srcPitch,
+                                  dst + (width - 1 - x) * dstPitch + y * 4, -dstPitch);
+                }
+                rotateScalar(src, srcPitch, dst, dstPitch, width, height, clockwise,
+                             x, tx + tw, y, y + 4);
+            }
+            rotateScalar(src, srcPitch, dst, dstPitch, width, height, clockwise,
+                         tx, tx + tw, y, ty + th);
+        }
+    }
+}
+
+}
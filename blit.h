@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <QImage>
+#include <QRect>
+#include <cstdint>
+
+/**
+ * @file blit.h
+ * @brief Kernels to convert premultiplied ARGB32 pixels into DRM plane formats, and to
+ * mirror and rotate pixels for planes that can't.
+ *
+ * Every kernel has a scalar version, and where it pays off NEON and SSE2 versions that give
+ * bit-exact the same result.  The fastest kernel available on the running CPU is picked at
+ * runtime for the format of a plane.  tests/blit checks the SIMD kernels against the scalar
+ * ones.
+ *
+ * YUV output uses BT.601 limited range.  NV12 chroma is the average of each 2x2 block, and
+ * YUYV chroma the average of each horizontal pair.
+ */
+namespace Blit
+{
+    /**
+     * @brief Instruction set of a kernel.
+     */
+    enum Isa
+    {
+        Scalar,
+        Sse2,
+        Neon,
+    };
+
+    /**
+     * @brief A kernel converting a block of width x height pixels.
+     *
+     * @param src First source pixel, premultiplied ARGB32.
+     * @param srcPitch Bytes per line of the source.
+     * @param dst First destination pixel.
+     * @param dstPitch Bytes per line of the destination.
+     * @param chroma First chroma sample for semi-planar formats, otherwise unused.
+     * @param chromaPitch Bytes per line of the chroma plane.
+     * @param width
+     * @param height
+     */
+    typedef void (*Kernel)(const uchar* src, int srcPitch,
+                           uchar* dst, int dstPitch,
+                           uchar* chroma, int chromaPitch,
+                           int width, int height);
+
+    /**
+     * @brief The best instruction set supported by the running CPU.
+     */
+    Isa bestIsa();
+
+    /**
+     * @brief Get the kernel for a DRM format.
+     * @param format DRM fourcc.
+     * @param isa Instruction set, falls back to scalar if there is no such version.
+     * @return Null if the format is not supported.
+     */
+    Kernel kernel(uint32_t format, Isa isa = bestIsa());
+
+    /**
+     * @brief The QImage format QPainter can render into directly for a DRM format.
+     * @return QImage::Format_Invalid if there is none, and a kernel must be used.
+     */
+    QImage::Format imageFormat(uint32_t format);
+
+    /**
+     * @brief The DRM format matching a QImage format, the inverse of imageFormat().
+     * @return 0 if there is none.
+     */
+    uint32_t drmFormat(QImage::Format format);
+
+    /**
+     * @brief Convert a rectangle of an image into a framebuffer at the same position.
+     *
+     * For semi-planar formats the chroma plane is expected right after height lines of
+     * luma.  For subsampled formats the rectangle is expanded outward to whole chroma
+     * samples, within the image.
+     *
+     * @param format DRM fourcc of the framebuffer.
+     * @param src Source image, converted to premultiplied ARGB32 if needed.
+     * @param rect Rectangle to convert.
+     * @param dst Framebuffer memory.
+     * @param pitch Bytes per line of the framebuffer.
+     * @param height Number of luma lines of the framebuffer.
+     * @return false if the format is not supported.
+     */
+    bool convert(uint32_t format, const QImage& src, const QRect& rect,
+                 uchar* dst, int pitch, int height);
+
+    /**
+     * @brief Copy a frame that is already in a DRM format into a framebuffer.
+     *
+     * For semi-planar formats the chroma plane is expected right after height lines of luma,
+     * in the source and in the framebuffer.
+     *
+     * @param format DRM fourcc of both.
+     * @param src First source pixel.
+     * @param srcPitch Bytes per line of the source.
+     * @param dst Framebuffer memory.
+     * @param pitch Bytes per line of the framebuffer.
+     * @param dstHeight Number of luma lines of the framebuffer.
+     * @param width
+     * @param height
+     */
+    void copy(uint32_t format, const uchar* src, int srcPitch,
+              uchar* dst, int pitch, int dstHeight, int width, int height);
+
+    /**
+     * @brief Mirror a block of pixels in place.
+     *
+     * Both flips together are a rotation by 180 degrees.
+     *
+     * @param data First pixel.
+     * @param pitch Bytes per line.
+     * @param bpp Bytes per pixel, 2 or 4.
+     * @param width
+     * @param height
+     * @param horizontal Reverse every line.
+     * @param vertical Reverse the order of the lines.
+     * @return false if bpp is not supported.
+     */
+    bool mirror(uchar* data, int pitch, int bpp, int width, int height,
+                bool horizontal, bool vertical);
+
+    /**
+     * @brief Rotate 32 bit pixels by 90 degrees.
+     *
+     * The destination must be height pixels wide and width pixels high.
+     *
+     * @param src First source pixel.
+     * @param srcPitch Bytes per line of the source.
+     * @param dst First destination pixel.
+     * @param dstPitch Bytes per line of the destination.
+     * @param width Source width.
+     * @param height Source height.
+     * @param clockwise Direction of the rotation.
+     */
+    void rotate(const uchar* src, int srcPitch, uchar* dst, int dstPitch,
+                int width, int height, bool clockwise);
+}
+
+#endif // BLIT_H
@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "cpusampler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Parsing helpers working on a buffer in place.
+ */
+
+static const char* skipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+static const char* skipField(const char* p, const char* end)
+{
+    p = skipSpaces(p, end);
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+        p++;
+    return p;
+}
+
+static const char* parseU64(const char* p, const char* end, uint64_t& value)
+{
+    p = skipSpaces(p, end);
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    return p;
+}
+
+static const char* nextLine(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+}
+
+/**
+ * @brief Read a whole proc file from the start into buf.
+ * @return Number of bytes read, 0 on error.
+ */
+static size_t readAll(int fd, char* buf, size_t size)
+{
+    if (fd < 0)
+        return 0;
+
+    ssize_t n = pread(fd, buf, size, 0);
+    return n > 0 ? n : 0;
+}
+
+/**
+ * @brief Get utime + stime and the name from a stat file of a process or thread.
+ *
+ * The name is in parentheses and may contain spaces, so fields are counted after the last
+ * closing parenthesis.
+ */
+static bool parseStat(const char* buf, size_t len, uint64_t& ticks, char* name, size_t nameSize)
+{
+    const char* end = buf + len;
+    const char* open = static_cast<const char*>(memchr(buf, '(', len));
+    const char* close = 0;
+    for (const char* p = end; p > buf; p--)
+    {
+        if (p[-1] == ')')
+        {
+            close = p - 1;
+            break;
+        }
+    }
+
+    if (!open || !close || close < open)
+        return false;
+
+    if (name)
+    {
+        size_t n = std::min<size_t>(close - open - 1, nameSize - 1);
+        memcpy(name, open + 1, n);
+        name[n] = 0;
+    }
+
+    // state is field 3, utime and stime are fields 14 and 15
+    const char* p = close + 1;
+    for (int field = 3; field < 14; field++)
+        p = skipField(p, end);
+
+    uint64_t utime, stime;
+    p = parseU64(p, end, utime);
+    parseU64(p, end, stime);
+    ticks = utime + stime;
+
+    return true;
+}
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static float percent(uint64_t part, uint64_t whole)
+{
+    return whole ? (float)part * 100.0f / whole : 0.0f;
+}
+
+double cpuMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+CpuSampler::CpuSampler()
+    : m_statFd(open("/proc/stat", O_RDONLY | O_CLOEXEC)),
+      m_selfFd(open("/proc/self/stat", O_RDONLY | O_CLOEXEC)),
+      m_taskFd(open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC)),
+      m_hz(sysconf(_SC_CLK_TCK)),
+      m_lastTime(0),
+      m_processTicks(0),
+      m_seq(0)
+{
+    memset(m_times, 0, sizeof(m_times));
+    memset(&m_work, 0, sizeof(m_work));
+    for (auto& word: m_published)
+        word.store(0, std::memory_order_relaxed);
+
+    for (auto& slot: m_slots)
+    {
+        slot.tid = 0;
+        slot.fd = -1;
+        slot.ticks = 0;
+        slot.seen = false;
+        slot.name[0] = 0;
+    }
+
+    if (m_hz <= 0)
+        m_hz = 100;
+}
+
+void CpuSampler::sample()
+{
+    uint64_t now = monotonicNs();
+    double elapsed = m_lastTime ? (now - m_lastTime) / 1e9 : 0;
+    m_lastTime = now;
+
+    Snapshot& s = m_work;
+
+    sampleSystem(s);
+    sampleProcess(s, elapsed);
+    sampleThreads(s, elapsed);
+
+    // the first sample only sets the baseline
+    if (elapsed <= 0)
+        return;
+
+    s.sequence++;
+
+    /*
+     * Sequence lock: the count is odd while the published copy is being written.  The copy
+     * is made of atomic words, so a reader racing with the writer only gets a torn copy it
+     * throws away, never a data race.
+     */
+    uint32_t words[PUBLISHED_WORDS] = {};
+    memcpy(words, &s, sizeof(s));
+
+    uint64_t seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (unsigned int i = 0; i < PUBLISHED_WORDS; i++)
+        m_published[i].store(words[i], std::memory_order_relaxed);
+    m_seq.store(seq + 2, std::memory_order_release);
+}
+
+CpuSampler::Snapshot CpuSampler::snapshot() const
+{
+    uint32_t words[PUBLISHED_WORDS];
+
+    while (true)
+    {
+        uint64_t before = m_seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        for (unsigned int i = 0; i < PUBLISHED_WORDS; i++)
+            words[i] = m_published[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (m_seq.load(std::memory_order_relaxed) == before)
+            break;
+    }
+
+    Snapshot s;
+    memcpy(&s, words, sizeof(s));
+
+    return s;
+}
+
+void CpuSampler::sampleSystem(Snapshot& s)
+{
+    /*
+     * Only the cpu lines at the start are needed, the rest of the file is not read.
+     */
+    char buf[4096];
+    size_t len = readAll(m_statFd, buf, sizeof(buf));
+    const char* p = buf;
+    const char* end = buf + len;
+
+    s.cores = 0;
+
+    while (p + 3 < end && !memcmp(p, "cpu", 3))
+    {
+        unsigned int index;
+        if (p[3] == ' ')
+            index = 0;
+        else if (s.cores < MAX_CORES)
+            index = ++s.cores;
+        else
+            break;
+
+        // user nice system idle iowait irq softirq steal
+        uint64_t v[8];
+        const char* q = skipField(p, end);
+        for (auto& x: v)
+            q = parseU64(q, end, x);
+
+        Times t;
+        t.total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+        t.busy = t.total - v[3] - v[4];
+
+        Times& last = m_times[index];
+        float usage = percent(t.busy - last.busy, t.total - last.total);
+        last = t;
+
+        if (index == 0)
+            s.total = usage;
+        else
+            s.core[index - 1] = usage;
+
+        p = nextLine(p, end);
+    }
+}
+
+void CpuSampler::sampleProcess(Snapshot& s, double elapsed)
+{
+    char buf[1024];
+    size_t len = readAll(m_selfFd, buf, sizeof(buf));
+
+    uint64_t ticks;
+    if (!len || !parseStat(buf, len, ticks, 0, 0))
+        return;
+
+    s.process = elapsed > 0 ? (ticks - m_processTicks) * 100.0f / (elapsed * m_hz) : 0;
+    m_processTicks = ticks;
+}
+
+void CpuSampler::scanThreads()
+{
+    for (auto& slot: m_slots)
+        slot.seen = false;
+
+    if (m_taskFd < 0)
+        return;
+
+    /*
+     * getdents64 on the directory kept open, instead of opendir() which allocates.
+     */
+    struct Dirent64
+    {
+        uint64_t ino;
+        int64_t off;
+        unsigned short reclen;
+        unsigned char type;
+        char name[];
+    };
+
+    char buf[4096];
+    lseek(m_taskFd, 0, SEEK_SET);
+
+    while (true)
+    {
+        long n = syscall(SYS_getdents64, m_taskFd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+
+        for (long off = 0; off < n;)
+        {
+            const Dirent64* d = reinterpret_cast<const Dirent64*>(buf + off);
+            off += d->reclen;
+
+            if (d->name[0] < '0' || d->name[0] > '9')
+                continue;
+
+            int tid = atoi(d->name);
+
+            ThreadSlot* empty = 0;
+            bool found = false;
+            for (auto& slot: m_slots)
+            {
+                if (slot.tid == tid)
+                {
+                    slot.seen = true;
+                    found = true;
+                    break;
+                }
+                if (!empty && slot.tid == 0)
+                    empty = &slot;
+            }
+
+            if (found || !empty)
+                continue;
+
+            char path[32];
+            snprintf(path, sizeof(path), "%d/stat", tid);
+            int fd = openat(m_taskFd, path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+
+            empty->tid = tid;
+            empty->fd = fd;
+            empty->ticks = 0;
+            empty->seen = true;
+            empty->name[0] = 0;
+
+            // start from the current counters, not from the thread creation
+            char stat[1024];
+            size_t len = readAll(fd, stat, sizeof(stat));
+            if (len)
+                parseStat(stat, len, empty->ticks, empty->name, sizeof(empty->name));
+        }
+    }
+
+    // threads that are gone
+    for (auto& slot: m_slots)
+    {
+        if (slot.tid && !slot.seen)
+        {
+            close(slot.fd);
+            slot.tid = 0;
+            slot.fd = -1;
+        }
+    }
+}
+
+void CpuSampler::sampleThreads(Snapshot& s, double elapsed)
+{
+    scanThreads();
+
+    s.threads = 0;
+
+    for (auto& slot: m_slots)
+    {
+        if (!slot.tid)
+            continue;
+
+        char buf[1024];
+        size_t len = readAll(slot.fd, buf, sizeof(buf));
+
+        uint64_t ticks;
+        if (!len || !parseStat(buf, len, ticks, slot.name, sizeof(slot.name)))
+            continue;
+
+        Thread& t = s.thread[s.threads++];
+        t.tid = slot.tid;
+        memcpy(t.name, slot.name, sizeof(t.name));
+        t.usage = elapsed > 0 ? (ticks - slot.ticks) * 100.0f / (elapsed * m_hz) : 0;
+        slot.ticks = ticks;
+    }
+}
+
+CpuSampler::~CpuSampler()
+{
+    for (auto& slot: m_slots)
+        if (slot.fd >= 0)
+            close(slot.fd);
+
+    if (m_taskFd >= 0)
+        close(m_taskFd);
+    if (m_selfFd >= 0)
+        close(m_selfFd);
+    if (m_statFd >= 0)
+        close(m_statFd);
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef CPUSAMPLER_H
+#define CPUSAMPLER_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief The CpuSampler class
+ *
+ * Measures CPU usage of every core, of this process, and of each of its threads.
+ *
+ * The proc files are opened once and read again with pread() on every sample, and parsed
+ * in place without allocating.  Counters are 64 bit, so they don't wrap on long uptimes.
+ *
+ * sample() must always be called from the same thread.  The latest results are published
+ * through a sequence lock, so snapshot() can be called from any thread without blocking
+ * the sampler.
+ */
+class CpuSampler
+{
+public:
+
+    static const unsigned int MAX_CORES = 16;
+    static const unsigned int MAX_THREADS = 32;
+
+    struct Thread
+    {
+        int tid;
+        char name[16];
+
+        /**
+         * @brief Percent of one core.
+         */
+        float usage;
+    };
+
+    struct Snapshot
+    {
+        /**
+         * @brief Number of samples taken, 0 until there is a first result.
+         */
+        uint64_t sequence;
+
+        /**
+         * @brief Percent of all cores.
+         */
+        float total;
+
+        unsigned int cores;
+
+        /**
+         * @brief Percent of each core.
+         */
+        float core[MAX_CORES];
+
+        /**
+         * @brief This process, in percent of one core.
+         */
+        float process;
+
+        unsigned int threads;
+        Thread thread[MAX_THREADS];
+    };
+
+    CpuSampler();
+
+    /**
+     * @brief Read the counters and publish usage since the previous call.
+     */
+    void sample();
+
+    /**
+     * @brief Get the latest published results.
+     */
+    Snapshot snapshot() const;
+
+    virtual ~CpuSampler();
+
+protected:
+
+    struct Times
+    {
+        uint64_t busy;
+        uint64_t total;
+    };
+
+    struct ThreadSlot
+    {
+        int tid;
+        int fd;
+        uint64_t ticks;
+        bool seen;
+        char name[16];
+    };
+
+    void sampleSystem(Snapshot& s);
+    void sampleProcess(Snapshot& s, double elapsed);
+    void sampleThreads(Snapshot& s, double elapsed);
+    void scanThreads();
+
+    int m_statFd;
+    int m_selfFd;
+    int m_taskFd;
+
+    long m_hz;
+    uint64_t m_lastTime;
+
+    /**
+     * @brief Aggregate first, then each core.
+     */
+    Times m_times[MAX_CORES + 1];
+
+    uint64_t m_processTicks;
+    ThreadSlot m_slots[MAX_THREADS];
+
+    Snapshot m_work;
+
+    /**
+     * @brief The published Snapshot, as 32 bit words that are lock-free on every target.
+     */
+    static const unsigned int PUBLISHED_WORDS = (sizeof(Snapshot) + 3) / 4;
+    std::atomic<uint32_t> m_published[PUBLISHED_WORDS];
+    mutable std::atomic<uint64_t> m_seq;
+};
+
+/**
+ * @brief CPU time used by this process so far, in milliseconds.
+ */
+double cpuMs();
+
+#endif // CPUSAMPLER_H
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "dmabufcache.h"
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <QDebug>
+
+#if defined(__has_include)
+#if __has_include(<linux/udmabuf.h>)
+#include <linux/udmabuf.h>
+#endif
+#endif
+
+DmaBufCache::DmaBufCache(struct kms_device* device, unsigned int limit)
+    : m_device(device),
+      m_limit(limit),
+      m_hits(0),
+      m_misses(0)
+{
+}
+
+struct kms_framebuffer* DmaBufCache::import(const DmaBuf& buffer)
+{
+    if (buffer.planes < 1 || buffer.planes > 4)
+        return 0;
+
+    /*
+     * Planes may come from other buffers than the first one, and two frames may share
+     * their luma but not their chroma, so every plane is part of the key.
+     */
+    Key key;
+    memset(&key, 0, sizeof(key));
+    key.planes = buffer.planes;
+    key.width = buffer.width;
+    key.height = buffer.height;
+    key.format = buffer.format;
+    key.modifier = buffer.modifier;
+
+    for (unsigned int i = 0; i < buffer.planes; i++)
+    {
+        struct stat st;
+        if (buffer.fds[i] < 0 || fstat(buffer.fds[i], &st))
+            return 0;
+
+        key.dev[i] = st.st_dev;
+        key.ino[i] = st.st_ino;
+        key.offset[i] = buffer.offsets[i];
+        key.pitch[i] = buffer.pitches[i];
+    }
+
+    for (auto i = m_entries.begin(); i != m_entries.end(); ++i)
+    {
+        if (i->key == key)
+        {
+            m_entries.splice(m_entries.begin(), m_entries, i);
+            m_hits++;
+            return m_entries.front().fb;
+        }
+    }
+
+    m_misses++;
+
+    Entry entry;
+    entry.key = key;
+    entry.fb = 0;
+    entry.users = 0;
+    memset(entry.handles, 0, sizeof(entry.handles));
+
+    uint32_t pitches[4] = {0, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    uint64_t modifiers[4] = {0, 0, 0, 0};
+
+    for (unsigned int i = 0; i < buffer.planes; i++)
+    {
+        // planes of one buffer usually share the fd, and then get the same handle
+        if (drmPrimeFDToHandle(m_device->fd, buffer.fds[i], &entry.handles[i]))
+        {
+            qDebug() << "failed to import dma-buf " << buffer.fds[i];
+            entry.handles[i] = 0;
+            destroy(entry);
+            return 0;
+        }
+
+        /*
+         * The device hands out one handle per buffer object, so entries of the same buffer
+         * at other offsets or formats share it.  Count each entry once.
+         */
+        if (std::find(entry.handles, entry.handles + i, entry.handles[i]) == entry.handles + i)
+            m_handles[entry.handles[i]]++;
+
+        pitches[i] = buffer.pitches[i];
+        offsets[i] = buffer.offsets[i];
+        modifiers[i] = buffer.modifier;
+    }
+
+    uint32_t id = 0;
+    int ret;
+    if (buffer.modifier != DRM_FORMAT_MOD_INVALID)
+        ret = drmModeAddFB2WithModifiers(m_device->fd, buffer.width, buffer.height,
+                                         buffer.format, entry.handles, pitches, offsets,
+                                         modifiers, &id, DRM_MODE_FB_MODIFIERS);
+    else
+        ret = drmModeAddFB2(m_device->fd, buffer.width, buffer.height, buffer.format,
+                            entry.handles, pitches, offsets, &id, 0);
+
+    if (ret)
+    {
+        qDebug() << "failed to add framebuffer for dma-buf: " << ret;
+        destroy(entry);
+        return 0;
+    }
+
+    /*
+     * A framebuffer like the ones libplanes creates, but without memory of its own.
+     */
+    entry.fb = static_cast<struct kms_framebuffer*>(calloc(1, sizeof(struct kms_framebuffer)));
+    entry.fb->device = m_device;
+    entry.fb->width = buffer.width;
+    entry.fb->height = buffer.height;
+    entry.fb->pitch = buffer.pitches[0];
+    entry.fb->format = buffer.format;
+    entry.fb->handle = entry.handles[0];
+    entry.fb->id = id;
+
+    trim(m_limit ? m_limit - 1 : 0);
+    m_entries.push_front(entry);
+
+    return m_entries.front().fb;
+}
+
+void DmaBufCache::ref(struct kms_framebuffer* fb, const ReleaseFunction& released)
+{
+    for (auto& e: m_entries)
+    {
+        if (e.fb == fb)
+        {
+            e.users++;
+            e.released = released;
+            return;
+        }
+    }
+}
+
+void DmaBufCache::unref(struct kms_framebuffer* fb)
+{
+    for (auto& e: m_entries)
+    {
+        if (e.fb == fb)
+        {
+            if (e.users && !--e.users && e.released)
+            {
+                ReleaseFunction released = e.released;
+                e.released = nullptr;
+                released();
+            }
+            break;
+        }
+    }
+
+    trim(m_limit);
+}
+
+bool DmaBufCache::contains(struct kms_framebuffer* fb) const
+{
+    for (auto& e: m_entries)
+        if (e.fb == fb)
+            return true;
+
+    return false;
+}
+
+void DmaBufCache::trim(unsigned int keep)
+{
+    auto i = m_entries.end();
+    while (m_entries.size() > keep && i != m_entries.begin())
+    {
+        --i;
+        if (i->users)
+            continue;
+
+        destroy(*i);
+        i = m_entries.erase(i);
+    }
+}
+
+void DmaBufCache::destroy(Entry& entry)
+{
+    if (entry.fb)
+    {
+        drmModeRmFB(m_device->fd, entry.fb->id);
+        free(entry.fb);
+        entry.fb = 0;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t handle = entry.handles[i];
+        if (!handle)
+            continue;
+
+        // a handle shared by several planes is counted once
+        for (int j = i; j < 4; j++)
+            if (entry.handles[j] == handle)
+                entry.handles[j] = 0;
+
+        // close it once no other entry uses it
+        auto ref = m_handles.find(handle);
+        if (ref == m_handles.end() || --ref->second)
+            continue;
+        m_handles.erase(ref);
+
+        struct drm_gem_close close;
+        memset(&close, 0, sizeof(close));
+        close.handle = handle;
+        drmIoctl(m_device->fd, DRM_IOCTL_GEM_CLOSE, &close);
+    }
+}
+
+int DmaBufCache::fromMemfd(int memfd, uint64_t offset, uint64_t size)
+{
+#ifdef UDMABUF_CREATE
+    int dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev < 0)
+        return -1;
+
+    struct udmabuf_create create;
+    memset(&create, 0, sizeof(create));
+    create.memfd = memfd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = offset;
+    create.size = size;
+
+    int fd = ioctl(dev, UDMABUF_CREATE, &create);
+    ::close(dev);
+
+    return fd;
+#else
+    Q_UNUSED(memfd);
+    Q_UNUSED(offset);
+    Q_UNUSED(size);
+    return -1;
+#endif
+}
+
+DmaBufCache::~DmaBufCache()
+{
+    for (auto& e: m_entries)
+        destroy(e);
+}
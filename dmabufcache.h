@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DMABUFCACHE_H
+#define DMABUFCACHE_H
+
+#include <planes/kms.h>
+#include <drm_fourcc.h>
+#include <sys/types.h>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+
+/**
+ * @brief A buffer shared through dma-buf file descriptors, as produced by decoders, cameras,
+ * GPUs or udmabuf.
+ */
+struct DmaBuf
+{
+    DmaBuf()
+        : planes(1),
+          width(0),
+          height(0),
+          format(0),
+          modifier(DRM_FORMAT_MOD_INVALID)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            fds[i] = -1;
+            pitches[i] = 0;
+            offsets[i] = 0;
+        }
+    }
+
+    /**
+     * @brief Number of memory planes of the format, up to 4.
+     */
+    unsigned int planes;
+    int fds[4];
+    uint32_t pitches[4];
+    uint32_t offsets[4];
+
+    unsigned int width;
+    unsigned int height;
+
+    /**
+     * @brief DRM fourcc.
+     */
+    uint32_t format;
+
+    /**
+     * @brief Layout modifier, DRM_FORMAT_MOD_INVALID to leave it to the driver.
+     */
+    uint64_t modifier;
+};
+
+/**
+ * @brief The DmaBufCache class
+ *
+ * Imports dma-bufs as KMS framebuffers, without copying them.
+ *
+ * Producers usually cycle through a small set of buffers, so imported framebuffers are
+ * kept by buffer identity and a buffer is only imported the first time it is seen.  The
+ * identity of a dma-buf is its inode, which stays the same whatever fd it is passed with,
+ * and a framebuffer is identified by the inode, offset and pitch of each of its planes.
+ *
+ * Framebuffers referenced with ref() are in use by a plane and never evicted.  The least
+ * recently used others are destroyed when the cache goes over its limit.
+ */
+class DmaBufCache
+{
+public:
+
+    typedef std::function<void()> ReleaseFunction;
+
+    /**
+     * @param device
+     * @param limit Number of imported framebuffers to keep.
+     */
+    DmaBufCache(struct kms_device* device, unsigned int limit = 32);
+
+    /**
+     * @brief Get the framebuffer of a dma-buf, importing it if needed.
+     * @return Null if the device can't import the buffer.
+     */
+    struct kms_framebuffer* import(const DmaBuf& buffer);
+
+    /**
+     * @brief A plane started to use a framebuffer.
+     * @param fb
+     * @param released Called once the framebuffer is no longer used by any plane.
+     */
+    void ref(struct kms_framebuffer* fb, const ReleaseFunction& released);
+
+    /**
+     * @brief A plane stopped using a framebuffer.
+     */
+    void unref(struct kms_framebuffer* fb);
+
+    /**
+     * @brief Is the framebuffer one of the cache?
+     */
+    bool contains(struct kms_framebuffer* fb) const;
+
+    /**
+     * @brief Wrap memfd memory into a dma-buf with udmabuf.
+     *
+     * The memfd must be sealed against shrinking, and offset and size must be page aligned.
+     *
+     * @return A dma-buf fd owned by the caller, or -1.
+     */
+    static int fromMemfd(int memfd, uint64_t offset, uint64_t size);
+
+    unsigned long hits() const
+    {
+        return m_hits;
+    }
+
+    unsigned long misses() const
+    {
+        return m_misses;
+    }
+
+    virtual ~DmaBufCache();
+
+protected:
+
+    /**
+     * @brief Identifies a buffer by the file and layout of each of its planes, zero for the
+     * planes it does not have.
+     */
+    struct Key
+    {
+        unsigned int planes;
+        dev_t dev[4];
+        ino_t ino[4];
+        uint32_t offset[4];
+        uint32_t pitch[4];
+        unsigned int width;
+        unsigned int height;
+        uint32_t format;
+        uint64_t modifier;
+
+        bool operator==(const Key& rhs) const
+        {
+            if (planes != rhs.planes || width != rhs.width || height != rhs.height ||
+                format != rhs.format || modifier != rhs.modifier)
+                return false;
+
+            for (unsigned int i = 0; i < planes; i++)
+                if (dev[i] != rhs.dev[i] || ino[i] != rhs.ino[i] ||
+                    offset[i] != rhs.offset[i] || pitch[i] != rhs.pitch[i])
+                    return false;
+
+            return true;
+        }
+    };
+
+    struct Entry
+    {
+        Key key;
+        struct kms_framebuffer* fb;
+        uint32_t handles[4];
+        unsigned int users;
+        ReleaseFunction released;
+    };
+
+    void trim(unsigned int keep);
+    void destroy(Entry& entry);
+
+    struct kms_device* m_device;
+    unsigned int m_limit;
+
+    /**
+     * @brief Imported framebuffers, most recently used first.
+     */
+    std::list<Entry> m_entries;
+
+    /**
+     * @brief Number of entries using each GEM handle.
+     */
+    std::map<uint32_t, unsigned int> m_handles;
+
+    unsigned long m_hits;
+    unsigned long m_misses;
+};
+
+#endif // DMABUFCACHE_H
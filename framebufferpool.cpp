@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "framebufferpool.h"
+#include <iterator>
+#include <QDebug>
+
+/**
+ * @brief Smallest size class.  Anything smaller is not worth tracking separately.
+ */
+static const unsigned int MIN_SIZE_CLASS = 64;
+
+FramebufferPool::FramebufferPool(struct kms_device* device, size_t limit)
+    : m_device(device),
+      m_limit(limit),
+      m_freeBytes(0),
+      m_hits(0),
+      m_misses(0)
+{
+}
+
+unsigned int FramebufferPool::sizeClass(unsigned int size)
+{
+    /*
+     * Classes grow by 25%, aligned to 16 pixels.  This bounds the slack in each dimension
+     * while keeping the number of distinct buffer sizes low.
+     */
+    unsigned int c = MIN_SIZE_CLASS;
+    while (c < size)
+        c = ((c + c / 4) + 15) & ~15u;
+    return c;
+}
+
+FramebufferPool::Buffer FramebufferPool::acquire(unsigned int width, unsigned int height, uint32_t format)
+{
+    unsigned int w = sizeClass(width);
+    unsigned int h = sizeClass(height);
+
+    /*
+     * Most recently released first, it is the most likely to still be in cache.
+     */
+    for (auto i = m_free.rbegin(); i != m_free.rend(); ++i)
+    {
+        if (i->fb->width == w && i->fb->height == h && i->fb->format == format)
+        {
+            Buffer buffer = *i;
+            m_free.erase(std::next(i).base());
+            m_freeBytes -= bytes(buffer);
+            m_hits++;
+            return buffer;
+        }
+    }
+
+    m_misses++;
+    qDebug() << "framebuffer pool miss " << w << "x" << h
+             << " hits " << m_hits << " misses " << m_misses;
+
+    Buffer buffer = {kms_framebuffer_create(m_device, w, h, format), 0};
+    if (!buffer.fb)
+    {
+        qDebug() << "failed to create framebuffer";
+        return buffer;
+    }
+
+    if (kms_framebuffer_map(buffer.fb, &buffer.ptr))
+    {
+        qDebug() << "failed to map framebuffer";
+        kms_framebuffer_free(buffer.fb);
+        buffer.fb = 0;
+    }
+
+    return buffer;
+}
+
+void FramebufferPool::release(const Buffer& buffer)
+{
+    if (buffer.fb)
+        m_released.push_back(buffer);
+}
+
+void FramebufferPool::vblank()
+{
+    if (m_released.empty())
+        return;
+
+    for (auto& b: m_released)
+    {
+        m_free.push_back(b);
+        m_freeBytes += bytes(b);
+    }
+    m_released.clear();
+
+    trim();
+}
+
+void FramebufferPool::trim()
+{
+    while (m_freeBytes > m_limit && !m_free.empty())
+    {
+        Buffer buffer = m_free.front();
+        m_free.pop_front();
+        m_freeBytes -= bytes(buffer);
+        destroy(buffer);
+    }
+}
+
+void FramebufferPool::destroy(const Buffer& buffer)
+{
+    kms_framebuffer_unmap(buffer.fb);
+    kms_framebuffer_free(buffer.fb);
+}
+
+FramebufferPool::~FramebufferPool()
+{
+    for (auto& b: m_free)
+        destroy(b);
+
+    for (auto& b: m_released)
+        destroy(b);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef FRAMEBUFFERPOOL_H
+#define FRAMEBUFFERPOOL_H
+
+#include <planes/kms.h>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <vector>
+
+/**
+ * @brief The FramebufferPool class
+ *
+ * A pool of mapped framebuffers shared by all planes.  Requested sizes are rounded up to
+ * geometric size classes, so a buffer has some slack and can be reused across resizes and
+ * items.  A plane shows only the part of the buffer it needs through its source rectangle.
+ *
+ * Released buffers may still be scanned out, so they only become available again after
+ * the next vblank.
+ */
+class FramebufferPool
+{
+public:
+
+    struct Buffer
+    {
+        struct kms_framebuffer* fb;
+        void* ptr;
+    };
+
+    /**
+     * @param device
+     * @param limit Maximum number of bytes kept in free buffers.
+     */
+    FramebufferPool(struct kms_device* device, size_t limit = 16 * 1024 * 1024);
+
+    /**
+     * @brief Get a mapped buffer of at least the requested size.
+     * @return A buffer with a null fb on failure.
+     */
+    Buffer acquire(unsigned int width, unsigned int height, uint32_t format);
+
+    /**
+     * @brief Return a buffer to the pool.
+     */
+    void release(const Buffer& buffer);
+
+    /**
+     * @brief Make buffers released before this vblank available again.
+     */
+    void vblank();
+
+    /**
+     * @brief Round a dimension up to its size class.
+     */
+    static unsigned int sizeClass(unsigned int size);
+
+    unsigned long hits() const
+    {
+        return m_hits;
+    }
+
+    unsigned long misses() const
+    {
+        return m_misses;
+    }
+
+    virtual ~FramebufferPool();
+
+protected:
+
+    void trim();
+    void destroy(const Buffer& buffer);
+
+    static size_t bytes(const Buffer& buffer)
+    {
+        return buffer.fb->pitch * buffer.fb->height;
+    }
+
+    struct kms_device* m_device;
+    size_t m_limit;
+    size_t m_freeBytes;
+
+    /**
+     * @brief Free buffers, most recently released last.
+     */
+    std::list<Buffer> m_free;
+
+    /**
+     * @brief Buffers released since the last vblank.
+     */
+    std::vector<Buffer> m_released;
+
+    unsigned long m_hits;
+    unsigned long m_misses;
+};
+
+#endif // FRAMEBUFFERPOOL_H
@@ -5,20 +5,50 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "graphicsplaneitem.h"
+#include "blit.h"
+#include "dmabufcache.h"
+#include "renderworker.h"
+#include "swapchain.h"
 #include <planes/plane.h>
+#include <drm_fourcc.h>
+#include <xf86drmMode.h>
 #include <QPainter>
 #include <QDebug>
 #include <QEvent>
 #include <QGraphicsSceneMouseEvent>
 #include <QStyleOptionGraphicsItem>
+#include <QTransform>
+#include <algorithm>
 
-GraphicsPlaneItem::GraphicsPlaneItem(struct plane_data* plane, const QRectF& bounding)
+GraphicsPlaneItem::GraphicsPlaneItem(PlaneManager& planes, struct plane_data* plane, const QRectF& bounding)
     : m_bounding(bounding),
-      m_plane(plane)
+      m_planes(planes),
+      m_plane(0),
+      m_pendingPlaneScale(1.0),
+      m_contentScale(1.0),
+      m_hardwareScaling(true),
+      m_stretchX(1.0),
+      m_stretchY(1.0),
+      m_scaledKey(0),
+      m_rotatedKey(0),
+      m_rotatedTurns(0),
+      m_rotation(0),
+      m_posDirty(false),
+      m_scaleDirty(false),
+      m_rotationDirty(false),
+      m_back(-1),
+      m_async(false),
+      m_rendering(false),
+      m_nextAsync(false),
+      m_generation(0),
+      m_deferred(false),
+      m_horizontal(false),
+      m_vertical(false),
+      m_scale(true),
+      m_drawPending(false),
+      m_frames(0),
+      m_changes(0)
 {
-    if (!plane)
-        qFatal("invalid plane pointer");
-
     /*
      * This is not a solid solution, but this prevents painting in most cases.  We don't need
      * to paint a plane unless the plane contents itself changes.  This means, we don't need
@@ -33,26 +63,129 @@ GraphicsPlaneItem::GraphicsPlaneItem(struct plane_data* plane, const QRectF& bou
      * ItemTransformOriginPointChange, and ItemTransformOriginPointHasChanged to itemChange().
      *
      * QGraphicsItem::ItemHasNoContents is the magic that prevents paint calls from the view/scene.
+     * It is only set while the item has a plane, see setPlane().
      */
     setFlags(QGraphicsItem::ItemSendsGeometryChanges |
-             QGraphicsItem::ItemClipsToShape |
-             QGraphicsItem::ItemHasNoContents);
+             QGraphicsItem::ItemClipsToShape);
+
+    m_vblankHandler = m_planes.addVBlankHandler([this]() { vblank(); });
+    m_prepareHandler = m_planes.addPrepareHandler([this]() { prepare(); });
+
+    setPlane(plane);
 
     moveEvent(pos());
 }
 
-QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant &value)
+GraphicsPlaneItem::~GraphicsPlaneItem()
 {
-    qDebug() << "GraphicsPlaneItem::itemChange " << change;
+    if (m_async || m_rendering)
+        RenderWorker::instance().cancel(this);
+
+    m_planes.removePrepareHandler(m_prepareHandler);
+    m_planes.removeVBlankHandler(m_vblankHandler);
+
+    m_planes.releasePlane(m_plane);
+}
 
-    if (change == GraphicsItemChange::ItemPositionChange)
+bool GraphicsPlaneItem::setPlane(struct plane_data* plane)
+{
+    if (plane == m_plane)
+        return false;
+
+    qDebug() << "GraphicsPlaneItem::setPlane " << (plane ? plane->name : "none");
+
+    /*
+     * Whatever is being rendered is for the old target.  The content is carried over by
+     * size only, and rendered again from scratch.
+     */
+    if (m_rendering)
     {
-        moveEvent(value.toPoint());
-        return value;
+        RenderWorker::instance().cancel(this);
+        m_rendering = false;
+        m_nextRender = nullptr;
     }
-    else if (change == GraphicsItemChange::ItemPositionHasChanged)
+    m_generation++;
+
+    QSize size = m_plane || !m_scratch.isNull() ? bufferSize() : QSize();
+
+    struct plane_data* old = m_plane;
+    m_plane = plane;
+    m_async = m_planes.options(plane).async;
+    m_back = -1;
+    m_deferred = false;
+    m_damage.clear();
+
+    setFlag(QGraphicsItem::ItemHasNoContents, plane != 0);
+
+    if (old)
+        m_planes.releasePlane(old);
+
+    // the item stacks with the other plane items by its zValue
+    if (plane)
+        m_planes.setStackOrder(plane, zValue());
+
+    if (!plane)
+    {
+        // Qt paints the content from the scratch image from now on
+        m_scratch = QImage();
+        QGraphicsObject::update();
+    }
+
+    planeChanged();
+
+    if (size.isValid() && !size.isEmpty())
+    {
+        resizeBuffers(size.width(), size.height());
+
+        // the plane needs the full geometry, not only what changes from now on
+        m_posDirty = true;
+        m_scaleDirty = true;
+        m_rotationDirty = true;
+        commit();
+
+        if (m_drawPending || !m_image.isNull())
+            draw(m_plane, m_image, m_horizontal, m_vertical, m_scale);
+        else
+            redraw();
+    }
+
+    return true;
+}
+
+void GraphicsPlaneItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+
+    // only called without a plane
+    if (m_scratch.isNull())
+        return;
+
+    if (m_stretchX != 1.0 || m_stretchY != 1.0)
+        painter->drawImage(QRectF(0, 0, m_scratch.width() * m_stretchX,
+                                  m_scratch.height() * m_stretchY), m_scratch);
+    else
+        painter->drawImage(QPointF(0, 0), m_scratch);
+}
+
+void GraphicsPlaneItem::commit()
+{
+    if (m_plane)
+        m_planes.commit(m_plane);
+}
+
+QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    qDebug() << "GraphicsPlaneItem::itemChange " << change;
+
+    /*
+     * Only the final position is of interest.  ItemPositionChange is just the proposed
+     * position, and would double the work.
+     */
+    if (change == GraphicsItemChange::ItemPositionHasChanged)
     {
-        moveEvent(value.toPoint());
+        m_changes++;
+        moveEvent(value.toPointF());
         return value;
     }
     else if (change == GraphicsItemChange::ItemScaleChange)
@@ -62,8 +195,53 @@ QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant
     else if (change == GraphicsItemChange::ItemScaleHasChanged)
     {
         qDebug() << "scale " << value.toFloat();
-        plane_set_scale(m_plane, value.toFloat());
-        plane_apply(m_plane);
+        m_changes++;
+        m_pendingPlaneScale = value.toReal();
+        m_scaleDirty = true;
+        commit();
+
+        // switch between the plane scaler and software scaling if the fit of draw() now
+        // falls in or out of the range of the plane
+        if (m_plane && m_scale && m_hardwareScaling && !m_image.isNull())
+        {
+            QSize fitted = m_image.size().scaled(m_bounding.size().toSize(), Qt::KeepAspectRatio);
+            qreal factor = (qreal)fitted.width() / m_image.width();
+            if (fitted != m_image.size() && (m_contentScale == factor) != scalerFits(factor))
+                draw(m_plane, m_image, m_horizontal, m_vertical, m_scale);
+        }
+    }
+    else if (change == GraphicsItemChange::ItemZValueHasChanged)
+    {
+        // only the zpos of the planes changes, the content stays as it is
+        if (m_plane)
+        {
+            m_changes++;
+            m_planes.setStackOrder(m_plane, value.toReal());
+        }
+    }
+    else if (change == GraphicsItemChange::ItemRotationHasChanged)
+    {
+        /*
+         * Planes only rotate by quarter turns.
+         */
+        qreal angle = value.toReal();
+        int rotation = ((qRound(angle / 90.0) % 4 + 4) % 4) * 90;
+        if (qAbs(angle - qRound(angle / 90.0) * 90.0) > 0.5)
+            qDebug() << "rotation " << angle << " rounded to " << rotation;
+
+        m_changes++;
+
+        if (rotation != m_rotation)
+        {
+            uint32_t software = softwareRotation();
+            m_rotation = rotation;
+            m_rotationDirty = true;
+            commit();
+
+            // content drawn with a software transform must be drawn again
+            if (softwareRotation() != software && !m_image.isNull())
+                draw(m_plane, m_image, m_horizontal, m_vertical, m_scale);
+        }
     }
 
     return QGraphicsItem::itemChange(change, value);
@@ -73,42 +251,701 @@ void GraphicsPlaneItem::moveEvent(const QPointF& point)
 {
     qDebug() << "GraphicsPlaneItem::moveEvent " << point;
 
-    plane_set_pos(m_plane, point.x(), point.y());
-    plane_apply(m_plane);
+    m_pendingPos = point;
+    m_posDirty = true;
+    commit();
+}
+
+uint32_t GraphicsPlaneItem::drmTransform() const
+{
+    /*
+     * Item rotation is clockwise on screen, DRM rotation counter-clockwise.
+     */
+    uint32_t flags;
+    switch (m_rotation)
+    {
+    case 90:
+        flags = DRM_MODE_ROTATE_270;
+        break;
+    case 180:
+        flags = DRM_MODE_ROTATE_180;
+        break;
+    case 270:
+        flags = DRM_MODE_ROTATE_90;
+        break;
+    default:
+        flags = DRM_MODE_ROTATE_0;
+        break;
+    }
+
+    if (m_horizontal)
+        flags |= DRM_MODE_REFLECT_X;
+    if (m_vertical)
+        flags |= DRM_MODE_REFLECT_Y;
+
+    return flags;
+}
+
+uint32_t GraphicsPlaneItem::hardwareRotation()
+{
+    if (!m_plane)
+        return DRM_MODE_ROTATE_0;
+
+    uint32_t flags = drmTransform();
+    if ((m_planes.supportedRotations(m_plane) & flags) == flags)
+        return flags;
+
+    return DRM_MODE_ROTATE_0;
+}
+
+uint32_t GraphicsPlaneItem::softwareRotation()
+{
+    uint32_t flags = drmTransform();
+
+    // without a plane, Qt rotates the item but knows nothing of the draw() flips
+    if (!m_plane)
+        return DRM_MODE_ROTATE_0 | (flags & (DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y));
+    if (hardwareRotation() == flags)
+        return DRM_MODE_ROTATE_0;
+
+    return flags;
+}
+
+QPointF GraphicsPlaneItem::planePos()
+{
+    /*
+     * Size of the content before rotation.  A buffer rotated in software is stored
+     * transposed.
+     */
+    QSize shown = presentedSize();
+    QSizeF size = QSizeF(shown.width() * m_stretchX,
+                         shown.height() * m_stretchY) * m_contentScale;
+    if (!m_image.isNull() && (softwareRotation() & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270)))
+        size.transpose();
+
+    /*
+     * The content of render() is not rotated in software, so unless the plane rotates it,
+     * it is shown and placed unrotated.
+     */
+    qreal rotation = m_rotation;
+    if (m_image.isNull() && softwareRotation() != DRM_MODE_ROTATE_0)
+        rotation = 0;
+
+    if (rotation == 0 && transformOriginPoint().isNull())
+        return m_pendingPos;
+
+    QPointF origin = transformOriginPoint();
+    QTransform t;
+    t.translate(origin.x(), origin.y());
+    t.rotate(rotation);
+    t.scale(m_pendingPlaneScale, m_pendingPlaneScale);
+    t.translate(-origin.x(), -origin.y());
+
+    return m_pendingPos + t.mapRect(QRectF(QPointF(0, 0), size)).topLeft();
+}
+
+void GraphicsPlaneItem::prepare()
+{
+    if (!m_plane)
+        return;
+
+    if (m_rotationDirty)
+    {
+        if (m_planes.supportedRotations(m_plane))
+            m_planes.setRotation(m_plane, hardwareRotation());
+
+        if (softwareRotation() != DRM_MODE_ROTATE_0 && m_image.isNull())
+            qDebug() << "plane can't rotate by " << m_rotation << ", content not rotated";
+    }
+
+    if (m_posDirty || m_scaleDirty || m_rotationDirty)
+    {
+        QPointF pos = planePos();
+        m_planes.setPos(m_plane, pos.x(), pos.y());
+        m_posDirty = false;
+    }
+
+    m_rotationDirty = false;
+
+    if (m_scaleDirty)
+    {
+        m_planes.setScale(m_plane,
+                          m_pendingPlaneScale * m_contentScale * m_stretchX,
+                          m_pendingPlaneScale * m_contentScale * m_stretchY);
+        m_scaleDirty = false;
+    }
+}
+
+bool GraphicsPlaneItem::resizeBuffers(unsigned int width, unsigned int height)
+{
+    /*
+     * A render in progress may be writing to a buffer that is about to go back to the pool.
+     * Wait for it, and make sure its result is dropped.
+     */
+    if (m_rendering)
+    {
+        RenderWorker::instance().cancel(this);
+        m_rendering = false;
+        m_nextRender = nullptr;
+    }
+    m_generation++;
+
+    m_back = -1;
+
+    if (!m_plane)
+    {
+        m_scratch = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+        m_scratch.fill(Qt::transparent);
+        m_damage.assign(1, QRegion(0, 0, width, height));
+        return !m_scratch.isNull();
+    }
+
+    SwapChain* chain = m_planes.swapchain(m_plane);
+    bool ret = chain->resize(width, height, plane_format(m_plane));
+
+    m_damage.assign(chain->count(), QRegion(0, 0, width, height));
+
+    // the plane position of a rotated item depends on its size
+    if (m_rotation)
+    {
+        m_posDirty = true;
+        commit();
+    }
+
+    return ret;
+}
+
+void GraphicsPlaneItem::damage(const QRegion& region)
+{
+    for (auto& d: m_damage)
+        d += region;
+}
+
+bool GraphicsPlaneItem::scalerFits(qreal factor) const
+{
+    // the plane applies the item scale and the stretch on top of the fit
+    const PlaneOptions& options = m_planes.options(m_plane);
+    qreal sx = m_pendingPlaneScale * factor * m_stretchX;
+    qreal sy = m_pendingPlaneScale * factor * m_stretchY;
+
+    return std::min(sx, sy) >= options.scaleMin && std::max(sx, sy) <= options.scaleMax;
+}
+
+bool GraphicsPlaneItem::stretch(const QSizeF& size)
+{
+    // relative to what is on screen, the buffers may already have a new size
+    QSize buffer = presentedSize();
+    if (buffer.isEmpty() || size.isEmpty())
+        return false;
+
+    // Qt paints the scratch image unscaled, only the plane fits the content of draw()
+    qreal content = m_plane ? m_contentScale : 1.0;
+    qreal x = size.width() / (buffer.width() * content);
+    qreal y = size.height() / (buffer.height() * content);
+
+    if (m_plane)
+    {
+        const PlaneCaps& caps = m_planes.caps(m_plane);
+        qreal sx = m_pendingPlaneScale * content * x;
+        qreal sy = m_pendingPlaneScale * content * y;
+        if (!caps.has(PlaneCaps::Scale) ||
+            std::min(sx, sy) < caps.scaleMin || std::max(sx, sy) > caps.scaleMax)
+            return false;
+    }
+
+    if (x == m_stretchX && y == m_stretchY)
+        return true;
+
+    m_stretchX = x;
+    m_stretchY = y;
+
+    if (m_plane)
+    {
+        // the plane position of a rotated item depends on its size
+        m_scaleDirty = true;
+        commit();
+    }
+    else
+    {
+        QGraphicsObject::update();
+    }
+
+    return true;
+}
+
+QRegion GraphicsPlaneItem::backBufferDamage() const
+{
+    if (m_back < 0)
+        return QRegion();
+
+    return m_damage[m_back];
+}
+
+QSize GraphicsPlaneItem::bufferSize()
+{
+    if (!m_plane)
+        return m_scratch.size();
+
+    SwapChain* chain = m_planes.swapchain(m_plane);
+    return QSize(chain->width(), chain->height());
+}
+
+QSize GraphicsPlaneItem::presentedSize()
+{
+    if (!m_plane)
+        return m_scratch.size();
+
+    SwapChain* chain = m_planes.swapchain(m_plane);
+    return QSize(chain->sourceWidth(), chain->sourceHeight());
+}
+
+QImage GraphicsPlaneItem::backBuffer()
+{
+    if (!m_plane)
+    {
+        /*
+         * The scratch image is the only buffer, and Qt paints from it.
+         */
+        if (m_scratch.isNull())
+            return QImage();
+
+        m_back = 0;
+        if (m_damage.size() != 1)
+            m_damage.assign(1, QRegion(m_scratch.rect()));
+        m_damage[0] &= QRegion(m_scratch.rect());
+
+        return QImage(m_scratch.bits(), m_scratch.width(), m_scratch.height(),
+                      m_scratch.bytesPerLine(), QImage::Format_ARGB32_Premultiplied);
+    }
+
+    SwapChain* chain = m_planes.swapchain(m_plane);
+
+    m_back = chain->acquire();
+    if (m_back < 0)
+    {
+        qDebug() << "no free buffer, deferring draw";
+        m_deferred = true;
+        m_planes.scheduleVBlank();
+        return QImage();
+    }
+
+    if (m_damage.size() != chain->count())
+        m_damage.assign(chain->count(), QRegion(0, 0, chain->width(), chain->height()));
+
+    m_damage[m_back] &= QRegion(0, 0, chain->width(), chain->height());
+
+    QImage::Format format = Blit::imageFormat(plane_format(m_plane));
+    if (format != QImage::Format_Invalid)
+    {
+        return QImage(static_cast<uchar*>(chain->buffer(m_back)),
+                      chain->width(), chain->height(), chain->pitch(),
+                      format);
+    }
+
+    /*
+     * QPainter can't render into this format.  Render into a premultiplied scratch image
+     * that holds the item content, and convert the damage into the buffer when swapping.
+     * Return an image wrapping the scratch memory so painting on it never detaches.
+     */
+    if (m_scratch.size() != QSize(chain->width(), chain->height()))
+    {
+        m_scratch = QImage(chain->width(), chain->height(), QImage::Format_ARGB32_Premultiplied);
+        m_scratch.fill(Qt::transparent);
+    }
+
+    return QImage(m_scratch.bits(), m_scratch.width(), m_scratch.height(),
+                  m_scratch.bytesPerLine(), QImage::Format_ARGB32_Premultiplied);
+}
+
+void GraphicsPlaneItem::convert(int index, const QRegion& region)
+{
+    SwapChain* chain = m_planes.swapchain(m_plane);
+    uint32_t format = plane_format(m_plane);
+
+    for (const QRect& r: region)
+        Blit::convert(format, m_scratch, r,
+                      static_cast<uchar*>(chain->buffer(index)), chain->pitch(),
+                      chain->framebuffer(index)->height);
+}
+
+void GraphicsPlaneItem::swapBuffers()
+{
+    if (m_back < 0)
+        return;
+
+    if (!m_plane)
+    {
+        if (m_stretchX != 1.0 || m_stretchY != 1.0)
+        {
+            // the content is at its new size, and the stretched area must be repainted
+            m_stretchX = m_stretchY = 1.0;
+            QGraphicsObject::update();
+        }
+
+        QGraphicsObject::update(m_damage[m_back].boundingRect());
+        m_damage[m_back] = QRegion();
+        m_back = -1;
+        m_frames++;
+        return;
+    }
+
+    if (Blit::imageFormat(plane_format(m_plane)) == QImage::Format_Invalid)
+        convert(m_back, m_damage[m_back]);
+
+    m_damage[m_back] = QRegion();
+    present(m_back);
+    m_back = -1;
+}
+
+bool GraphicsPlaneItem::swapFrame(const uchar* data, int pitch)
+{
+    if (!m_plane)
+        return false;
+
+    SwapChain* chain = m_planes.swapchain(m_plane);
+
+    int index = chain->acquire();
+    if (index < 0)
+    {
+        m_deferred = true;
+        m_planes.scheduleVBlank();
+        return false;
+    }
+
+    Blit::copy(plane_format(m_plane), data, pitch,
+               static_cast<uchar*>(chain->buffer(index)), chain->pitch(),
+               chain->framebuffer(index)->height, chain->width(), chain->height());
+
+    // the whole buffer is new, and the other buffers are now behind
+    for (auto& d: m_damage)
+        d = QRegion(0, 0, chain->width(), chain->height());
+    if (index < (int)m_damage.size())
+        m_damage[index] = QRegion();
+
+    present(index);
+    return true;
+}
+
+void GraphicsPlaneItem::present(int index)
+{
+    m_frames++;
+
+    /*
+     * The buffer goes out with its real size, in the same commit.  A stretch still keeps
+     * the content at the size it was stretched to, which a buffer rendered at that size
+     * cancels out.
+     */
+    QSize before = presentedSize();
+    SwapChain* chain = m_planes.swapchain(m_plane);
+    bool changed = chain->present(index);
+
+    QSize after = presentedSize();
+    if (after != before)
+    {
+        if (!before.isEmpty() && !after.isEmpty())
+        {
+            // within a pixel, the buffer is at the stretched size
+            qreal width = m_stretchX * before.width();
+            qreal height = m_stretchY * before.height();
+            m_stretchX = qAbs(width - after.width()) < 1.0 ? 1.0 : width / after.width();
+            m_stretchY = qAbs(height - after.height()) < 1.0 ? 1.0 : height / after.height();
+        }
+        m_scaleDirty = true;
+        changed = true;
+    }
+
+    if (changed)
+        commit();
+}
+
+bool GraphicsPlaneItem::showBuffer(const DmaBuf& buffer)
+{
+    if (!m_plane || !m_planes.dmabufs())
+        return false;
+
+    uint64_t modifier = buffer.modifier == DRM_FORMAT_MOD_INVALID ? 0 : buffer.modifier;
+    if (!m_planes.caps(m_plane).supports(buffer.format, modifier))
+    {
+        qDebug() << "plane " << m_plane->name << " can't show dma-buf format " << buffer.format;
+        return false;
+    }
+
+    DmaBufCache* cache = m_planes.dmabufs();
+    struct kms_framebuffer* fb = cache->import(buffer);
+    if (!fb)
+        return false;
+
+    ReleaseFunction handler = m_releaseHandler;
+    cache->ref(fb, [handler, buffer]() {
+        if (handler)
+            handler(buffer);
+    });
+
+    m_frames++;
+
+    if (m_stretchX != 1.0 || m_stretchY != 1.0)
+    {
+        m_stretchX = m_stretchY = 1.0;
+        m_scaleDirty = true;
+    }
+
+    if (m_planes.swapchain(m_plane)->presentExternal(fb))
+        commit();
+
+    return true;
+}
+
+bool GraphicsPlaneItem::render(const RenderFunction& paint, bool async)
+{
+    if (m_rendering)
+    {
+        m_nextRender = paint;
+        m_nextAsync = async;
+        return true;
+    }
+
+    QImage fb = backBuffer();
+    if (fb.isNull())
+        return false;
+
+    QRegion damaged = backBufferDamage();
+
+    // without a plane, Qt paints from the image on the GUI thread
+    if (!(m_async || async) || !m_plane)
+    {
+        paint(fb, damaged);
+        swapBuffers();
+        return true;
+    }
+
+    /*
+     * Hand the buffer over to the worker.  Its damage is consumed now, so anything damaged
+     * while the worker runs is rendered next time.  The image is created on the worker, a
+     * second reference to it would make QPainter detach into a copy.
+     */
+    int back = m_back;
+    m_back = -1;
+    m_damage[back] = QRegion();
+    m_rendering = true;
+
+    uchar* data = fb.bits();
+    QSize size = fb.size();
+    int pitch = fb.bytesPerLine();
+    QImage::Format format = fb.format();
+    fb = QImage();
+
+    /*
+     * For formats QPainter can't render into, the worker also converts the scratch image
+     * into the buffer.
+     */
+    uint32_t drmFormat = 0;
+    uchar* buffer = 0;
+    int bufferPitch = 0;
+    int bufferHeight = 0;
+    if (Blit::imageFormat(plane_format(m_plane)) == QImage::Format_Invalid)
+    {
+        SwapChain* chain = m_planes.swapchain(m_plane);
+        drmFormat = plane_format(m_plane);
+        buffer = static_cast<uchar*>(chain->buffer(back));
+        bufferPitch = chain->pitch();
+        bufferHeight = chain->framebuffer(back)->height;
+    }
+
+    unsigned int generation = m_generation;
+
+    RenderWorker::instance().submit(this,
+                                    [paint, data, size, pitch, format, damaged,
+                                     drmFormat, buffer, bufferPitch, bufferHeight]() {
+                                        QImage image(data, size.width(), size.height(), pitch,
+                                                     format);
+                                        paint(image, damaged);
+
+                                        if (buffer)
+                                            for (const QRect& r: damaged)
+                                                Blit::convert(drmFormat, image, r,
+                                                              buffer, bufferPitch, bufferHeight);
+                                    },
+                                    [this, back, generation]() {
+                                        if (generation != m_generation)
+                                            return;
+
+                                        m_rendering = false;
+                                        present(back);
+
+                                        if (m_nextRender)
+                                        {
+                                            RenderFunction next = m_nextRender;
+                                            m_nextRender = nullptr;
+                                            render(next, m_nextAsync);
+                                        }
+                                    });
+
+    return true;
+}
+
+void GraphicsPlaneItem::customEvent(QEvent* event)
+{
+    if (event->type() == RenderDoneEvent::type())
+    {
+        static_cast<RenderDoneEvent*>(event)->done();
+        return;
+    }
+
+    QGraphicsObject::customEvent(event);
+}
+
+void GraphicsPlaneItem::vblank()
+{
+    if (m_deferred)
+    {
+        m_deferred = false;
+        redraw();
+    }
+}
+
+void GraphicsPlaneItem::redraw()
+{
+    if (m_drawPending)
+        draw(m_plane, m_image, m_horizontal, m_vertical, m_scale);
 }
 
 void GraphicsPlaneItem::draw(struct plane_data* plane, QImage image, bool horizontal, bool vertical, bool scale)
 {
-    if ((int)plane_width(plane) != image.width() || (int)plane_height(plane) != image.height())
-        plane_fb_reallocate(plane, image.width(), image.height(), plane_format(plane));
+    // buffers are managed by the swap chain of the item's own plane
+    Q_ASSERT(plane == m_plane);
+    Q_UNUSED(plane);
 
-    plane_fb_map(plane);
+    if (horizontal != m_horizontal || vertical != m_vertical)
+    {
+        m_horizontal = horizontal;
+        m_vertical = vertical;
+        m_rotationDirty = true;
+        commit();
+    }
+    m_image = image;
+    m_scale = scale;
+    m_drawPending = false;
 
-    QImage fb(static_cast<uchar*>(plane->buf),
-              plane_width(plane), plane_height(plane),
-              QImage::Format_ARGB32_Premultiplied);
+    QImage content(image);
+    qreal contentScale = 1.0;
 
-    QPainter painter(&fb);
-    painter.setTransform(transform());
-    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    if (scale && !image.isNull())
+    {
+        QSize fitted = image.size().scaled(m_bounding.size().toSize(), Qt::KeepAspectRatio);
+        qreal factor = (qreal)fitted.width() / image.width();
 
-    QImage transformedImage(image);
+        if (m_hardwareScaling && m_plane && scalerFits(factor))
+        {
+            /*
+             * Keep the image at its native size and let the plane scaler fit it.
+             */
+            contentScale = factor;
+        }
+        else if (fitted != image.size())
+        {
+            /*
+             * Outside of what the plane scaler can do.  Scale in software, but only once
+             * for a given image and size.
+             */
+            if (m_scaledKey != image.cacheKey() || m_scaledImage.size() != fitted)
+            {
+                qDebug() << "software scale " << image.size() << " to " << fitted;
+                m_scaledKey = image.cacheKey();
+                m_scaledImage = image.scaled(fitted, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            }
+            content = m_scaledImage;
+        }
+    }
 
-    if (scale)
+    if (contentScale != m_contentScale)
     {
-        QSize imageSize = image.size();
-        imageSize.scale(QSize(plane_width(plane), plane_height(plane)), Qt::KeepAspectRatio);
+        m_contentScale = contentScale;
+        m_scaleDirty = true;
+        commit();
+    }
 
-        transformedImage = image.scaled(imageSize,
-                                      Qt::KeepAspectRatio,
-                                      Qt::SmoothTransformation);
+    /*
+     * Whatever the plane can't rotate or mirror is done here.  The plane reflects the content
+     * before rotating it.  Done the other way around, a quarter turn swaps the axes of the
+     * reflection, and a half turn is the same as both reflections.
+     */
+    uint32_t software = softwareRotation();
+    int turns = 0;
+    bool mirrorX = software & DRM_MODE_REFLECT_X;
+    bool mirrorY = software & DRM_MODE_REFLECT_Y;
+    if (software & DRM_MODE_ROTATE_90)
+        turns = 3;
+    else if (software & DRM_MODE_ROTATE_180)
+        turns = 2;
+    else if (software & DRM_MODE_ROTATE_270)
+        turns = 1;
+
+    if (turns == 2)
+    {
+        mirrorX = !mirrorX;
+        mirrorY = !mirrorY;
+        turns = 0;
     }
+    else if (turns)
+    {
+        std::swap(mirrorX, mirrorY);
+    }
+
+    QSize size = content.size();
+    if (turns)
+        size.transpose();
+
+    if (bufferSize() != size)
+        resizeBuffers(size.width(), size.height());
+
+    damage(QRegion(QRect(QPoint(0, 0), bufferSize())));
 
-    if (horizontal || vertical)
+    /*
+     * The item transform and any scaling are applied by the plane, so the content is
+     * written as is with the kernel for the buffer format, then mirrored in place.
+     */
+    if (turns && content.format() != QImage::Format_ARGB32_Premultiplied)
+        content = content.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    /*
+     * A quarter turn is written straight into an ARGB8888 buffer.  Other formats need the
+     * rotated pixels for their kernel, which are kept for as long as the content is the same.
+     */
+    QImage rotated;
+    if (turns && plane_format(m_plane) != DRM_FORMAT_ARGB8888)
     {
-        transformedImage = transformedImage.mirrored(horizontal, vertical);
+        if (m_rotatedKey != content.cacheKey() || m_rotatedTurns != turns)
+        {
+            m_rotatedKey = content.cacheKey();
+            m_rotatedTurns = turns;
+            m_rotatedImage = QImage(content.height(), content.width(),
+                                    QImage::Format_ARGB32_Premultiplied);
+            Blit::rotate(content.constBits(), content.bytesPerLine(),
+                         m_rotatedImage.bits(), m_rotatedImage.bytesPerLine(),
+                         content.width(), content.height(), turns == 1);
+        }
+        rotated = m_rotatedImage;
     }
 
-    painter.drawImage(QPoint(0,0), transformedImage);
-    painter.end();
+    bool ok = render([content, rotated, turns, mirrorX, mirrorY](QImage& fb, const QRegion& damaged) {
+        Q_UNUSED(damaged);
+
+        if (turns && rotated.isNull())
+            Blit::rotate(content.constBits(), content.bytesPerLine(),
+                         fb.bits(), fb.bytesPerLine(),
+                         content.width(), content.height(), turns == 1);
+        else if (turns)
+            Blit::convert(Blit::drmFormat(fb.format()), rotated, rotated.rect(),
+                          fb.bits(), fb.bytesPerLine(), fb.height());
+        else
+            Blit::convert(Blit::drmFormat(fb.format()), content, content.rect(),
+                          fb.bits(), fb.bytesPerLine(), fb.height());
+
+        if (mirrorX || mirrorY)
+            Blit::mirror(fb.bits(), fb.bytesPerLine(), fb.depth() / 8,
+                         fb.width(), fb.height(), mirrorX, mirrorY);
+    });
+
+    if (!ok)
+        m_drawPending = true;
 }
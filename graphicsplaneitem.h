@@ -9,31 +9,107 @@
 
 #include <QGraphicsObject>
 #include <QDebug>
+#include <QRegion>
+#include <functional>
+#include <vector>
 #include "planemanager.h"
 #include <QGraphicsView>
 
+struct DmaBuf;
+
 /**
  * @brief The GraphicsPlaneItem class
  *
  * A QGraphicsObject that translates functions away from native Qt operations into hardware
  * planes functions using libplanes.
+ *
+ * Without a plane, the same content is rendered into an image that Qt composites like any
+ * other item.  See PlaneAllocator for moving items between the two.
+ *
+ * The zValue of the item sets the zpos of its plane relative to the planes of the other
+ * items, see PlaneManager::setStackOrder().
  */
 class GraphicsPlaneItem : public QGraphicsObject
 {
 public:
 
-    GraphicsPlaneItem(struct plane_data* plane, const QRectF& bounding);
+    /**
+     * @brief Function that renders the damaged region of a plane buffer.
+     */
+    typedef std::function<void(QImage& fb, const QRegion& damage)> RenderFunction;
+
+    /**
+     * @brief Function called when a buffer given to showBuffer() is no longer on screen.
+     */
+    typedef std::function<void(const DmaBuf& buffer)> ReleaseFunction;
+
+    /**
+     * @param planes
+     * @param plane Plane to show the item on, or null to have it composited by Qt until
+     * setPlane() is called.
+     * @param bounding
+     */
+    GraphicsPlaneItem(PlaneManager& planes, struct plane_data* plane, const QRectF& bounding);
 
     virtual QRectF boundingRect() const override
     {
         return m_bounding;
     }
 
-    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    /**
+     * @brief Only called while the item has no plane, to let Qt composite its content.
+     */
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+    /**
+     * @brief Move the item to another plane, or to Qt compositing with a null plane.
+     *
+     * The previous plane is given back with PlaneManager::releasePlane().  Buffers of the
+     * same size are set up on the new target, and the content is rendered again through
+     * draw() or redraw().
+     *
+     * @return false if the item already uses this plane.
+     */
+    bool setPlane(struct plane_data* plane);
+
+    struct plane_data* plane() const
     {
-        Q_UNUSED(painter);
-        Q_UNUSED(option);
-        Q_UNUSED(widget);
+        return m_plane;
+    }
+
+    /**
+     * @brief Number of buffers presented so far, on a plane or to Qt.
+     */
+    unsigned long frameCount() const
+    {
+        return m_frames;
+    }
+
+    /**
+     * @brief Scan out a dma-buf on the plane, without copying it.
+     *
+     * The buffer is imported once and then reused each time it is shown again.  It must stay
+     * untouched until the release handler is called for it.  It is expected to be the size
+     * of the item, and to be in a format the plane supports.
+     *
+     * @return false if the item has no plane, or the plane can't show the buffer.
+     */
+    bool showBuffer(const DmaBuf& buffer);
+
+    /**
+     * @brief Set the function called when a buffer given to showBuffer() can be reused.
+     */
+    void setReleaseHandler(const ReleaseFunction& handler)
+    {
+        m_releaseHandler = handler;
+    }
+
+    /**
+     * @brief Number of position, scale and rotation changes so far.
+     */
+    unsigned long changeCount() const
+    {
+        return m_changes;
     }
 
     /**
@@ -47,13 +123,137 @@ public:
         Q_UNUSED(rect);
     }
 
-    virtual ~GraphicsPlaneItem()
-    {}
+    /**
+     * @brief Use the plane scaler to fit images passed to draw().
+     *
+     * When enabled and the scale factor is within the limits of the plane, the framebuffer
+     * keeps the native size of the image.  Otherwise, the image is scaled in software.
+     */
+    void setHardwareScaling(bool enable)
+    {
+        m_hardwareScaling = enable;
+    }
+
+    virtual ~GraphicsPlaneItem();
 
 protected:
 
     virtual void moveEvent(const QPointF& point);
 
+    /**
+     * @brief Reallocate the framebuffers of the plane.
+     *
+     * Every buffer in the swap chain of the plane is reallocated.  Render and swap a buffer
+     * right after this.
+     */
+    bool resizeBuffers(unsigned int width, unsigned int height);
+
+    /**
+     * @brief Visible size of the plane framebuffers.
+     *
+     * Framebuffers may be larger than this, use this instead of plane_width() and
+     * plane_height().
+     */
+    QSize bufferSize();
+
+    /**
+     * @brief Size of the buffer on screen, or about to be.
+     *
+     * After the buffers are resized, this keeps the previous size until a buffer of the new
+     * size is presented.
+     */
+    QSize presentedSize();
+
+    /**
+     * @brief Get the back buffer of the plane to render into.
+     *
+     * The returned image wraps the framebuffer memory directly, in the QImage format that
+     * matches the plane format.  For formats QPainter can't render into, such as YUV, it is
+     * a premultiplied ARGB32 image that is converted into the buffer by swapBuffers().
+     *
+     * If every buffer is still on screen or waiting for vblank, a null image is returned
+     * and redraw() is called once a buffer is released.
+     */
+    QImage backBuffer();
+
+    /**
+     * @brief Mark a region of the plane content as changed.
+     *
+     * Damage is tracked separately for every buffer of the swap chain, so a back buffer
+     * only needs the regions that changed since it was last rendered.
+     */
+    void damage(const QRegion& region);
+
+    /**
+     * @brief Show the current content stretched to a new size, without rendering it.
+     *
+     * On a plane the plane scaler stretches the buffer.  Without a plane, Qt scales the
+     * content when it paints it.  The size is relative to presentedSize(), and kept when a
+     * buffer of another size is presented, so a buffer rendered at the new size ends the
+     * stretch.
+     *
+     * @param size Size of the content in item coordinates.
+     * @return false if the plane can't scale that far.
+     */
+    bool stretch(const QSizeF& size);
+
+    /**
+     * @brief Damage of the buffer returned by the last backBuffer() call.
+     *
+     * Only this region needs to be rendered before swapBuffers().
+     */
+    QRegion backBufferDamage() const;
+
+    /**
+     * @brief Present the buffer returned by the last backBuffer() call.
+     *
+     * The buffer goes to the screen with the next PlaneManager commit.
+     */
+    void swapBuffers();
+
+    /**
+     * @brief Copy a frame that is already in the plane format into a back buffer, and
+     * present it.
+     *
+     * The frame is the size of the buffers.  For semi-planar formats its chroma plane
+     * follows its luma plane.  Nothing is converted, so this needs a plane.
+     *
+     * @return false without a plane, or if no buffer is free, in which case redraw() is
+     * called later.
+     */
+    bool swapFrame(const uchar* data, int pitch);
+
+    /**
+     * @brief Render the back buffer and present it.
+     *
+     * This wraps backBuffer(), backBufferDamage() and swapBuffers().  If the "async" option
+     * is set for the plane, the function runs on the RenderWorker thread and the buffer is
+     * presented from the GUI thread once it is done.  In that case the function must not
+     * touch the item; capture whatever state it needs by value.
+     *
+     * Only one render is in progress at a time.  A render requested meanwhile is run after
+     * it, and only the latest such request is kept.
+     *
+     * @param paint
+     * @param async Run on the RenderWorker even if the "async" option is not set.
+     * @return false if no buffer is free, in which case redraw() is called later.
+     */
+    bool render(const RenderFunction& paint, bool async = false);
+
+    /**
+     * @brief Called when a deferred backBuffer() request can be satisfied.
+     */
+    virtual void redraw();
+
+    /**
+     * @brief Called by setPlane() once the item is on its new target, before the content
+     * is rendered again.
+     */
+    virtual void planeChanged()
+    {}
+
+    virtual void customEvent(QEvent* event) override;
+
     /**
      * @brief draw
      *
@@ -63,13 +263,149 @@ protected:
      * @param image
      * @param horizontal
      * @param vertical
+     * @param scale Fit the image to the bounding rect, see setHardwareScaling().
      */
     void draw(struct plane_data* plane, QImage image, bool horizontal = false, bool vertical = false, bool scale = true);
 
     virtual QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
 
+    /**
+     * @brief Rotation and reflection of the content that the plane can't do.
+     *
+     * The item rotation and the flips of draw() are done by the plane when it supports them
+     * together.  Otherwise they are left to software, and this returns the
+     * DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* flags to apply to the buffer content.
+     * draw() handles this itself, other content is only mirrored by the plane.
+     */
+    uint32_t softwareRotation();
+
     QRectF m_bounding;
+    PlaneManager& m_planes;
     struct plane_data* m_plane;
+
+private:
+
+    void vblank();
+
+    /**
+     * @brief Commit the plane, if there is one.
+     */
+    void commit();
+
+    /**
+     * @brief Push pending geometry to the PlaneManager right before a commit.
+     */
+    void prepare();
+
+    void present(int index);
+
+    /**
+     * @brief The DRM rotation and reflection flags for the item rotation and draw() flips.
+     */
+    uint32_t drmTransform() const;
+
+    /**
+     * @brief The part of drmTransform() done by the plane.
+     */
+    uint32_t hardwareRotation();
+
+    /**
+     * @brief Screen position of the top left corner of the plane.
+     *
+     * The item rotates around its transform origin, so a rotated plane starts at the top
+     * left corner of the rotated content rather than at the item position.
+     */
+    QPointF planePos();
+
+    /**
+     * @brief Whether the plane scaler can fit content by a factor, combined with the item
+     * scale and the stretch.
+     */
+    bool scalerFits(qreal factor) const;
+
+    /**
+     * @brief Convert a region of the scratch image into a buffer.
+     */
+    void convert(int index, const QRegion& region);
+
+    /**
+     * @brief Geometry waiting for the next commit.  Only the latest value of a frame is used.
+     */
+    QPointF m_pendingPos;
+    qreal m_pendingPlaneScale;
+
+    /**
+     * @brief Scale applied by the plane to fit the content of draw(), on top of the item scale.
+     */
+    qreal m_contentScale;
+    bool m_hardwareScaling;
+
+    /**
+     * @brief Stretch of the presented buffer, see stretch().
+     */
+    qreal m_stretchX;
+    qreal m_stretchY;
+
+    /**
+     * @brief Last software scaled image of draw(), and the cacheKey() of its source.
+     */
+    qint64 m_scaledKey;
+    QImage m_scaledImage;
+
+    /**
+     * @brief Last content of draw() rotated in software for a buffer that is not ARGB8888, and
+     * the cacheKey() and quarter turns it was rotated from.
+     */
+    qint64 m_rotatedKey;
+    int m_rotatedTurns;
+    QImage m_rotatedImage;
+
+    /**
+     * @brief Item rotation in degrees clockwise, a multiple of 90.
+     */
+    int m_rotation;
+
+    bool m_posDirty;
+    bool m_scaleDirty;
+    bool m_rotationDirty;
+    int m_prepareHandler;
+
+    /**
+     * @brief Item content for plane formats QPainter can't render into, and for Qt to paint
+     * while the item has no plane.
+     */
+    QImage m_scratch;
+
+    int m_back;
+    std::vector<QRegion> m_damage;
+
+    bool m_async;
+    bool m_rendering;
+    RenderFunction m_nextRender;
+    bool m_nextAsync;
+
+    /**
+     * @brief Incremented when buffers are reallocated, to drop renders into old buffers.
+     */
+    unsigned int m_generation;
+
+    bool m_deferred;
+    int m_vblankHandler;
+
+    /**
+     * @brief Arguments of the latest draw(), run again if it was deferred for lack of a free
+     * buffer, or when the software part of the transform changes.
+     */
+    QImage m_image;
+    bool m_horizontal;
+    bool m_vertical;
+    bool m_scale;
+    bool m_drawPending;
+
+    unsigned long m_frames;
+    unsigned long m_changes;
+
+    ReleaseFunction m_releaseHandler;
 };
 
 #endif // GRAPHICSPLANEITEM_H
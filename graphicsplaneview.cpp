@@ -5,22 +5,225 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "graphicsplaneview.h"
+#include "latencytracker.h"
+#include "planemanager.h"
+#include <xf86drmMode.h>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QPaintEvent>
 #include <QGraphicsItem>
+#include <QScreen>
+#include <QWindow>
+#include <algorithm>
+#include <limits>
+#include <vector>
 
-GraphicsPlaneView::GraphicsPlaneView(QGraphicsScene *scene)
-    : QGraphicsView(scene)
+/**
+ * @brief Most rectangles a frame is split into.
+ */
+static const int MAX_DAMAGE_RECTS = 8;
+
+/**
+ * @brief More rectangles than this are binned into a coarse grid before being merged.
+ */
+static const int MAX_MERGE_RECTS = 64;
+
+/**
+ * @brief Cells per side of the grid, so there are at most MAX_MERGE_RECTS of them.
+ */
+static const int MERGE_GRID = 8;
+
+static qint64 area(const QRect& r)
+{
+    return r.isEmpty() ? 0 : qint64(r.width()) * r.height();
+}
+
+GraphicsPlaneView::GraphicsPlaneView(QGraphicsScene *scene, PlaneManager* planes)
+    : QGraphicsView(scene),
+      m_planes(planes),
+      m_damagedPixels(0),
+      m_frameTime(0)
 {
     setAttribute(Qt::WA_NoSystemBackground);
-    setViewportUpdateMode(ViewportUpdateMode::SmartViewportUpdate);
+
+    /*
+     * Get the exact damage of every frame, merging is done in flushDamage().  Smart updates
+     * fall back to the bounding rect of everything as soon as there are a few rectangles.
+     */
+    setViewportUpdateMode(ViewportUpdateMode::MinimalViewportUpdate);
+}
+
+QVector<QRect> GraphicsPlaneView::merge(QVector<QRect> rects)
+{
+    if (rects.size() > MAX_MERGE_RECTS)
+    {
+        /*
+         * Many small rectangles, like many small moving items, are first merged with the
+         * ones whose center falls in the same cell of a coarse grid over their bounding
+         * rect.  Rectangles far apart stay apart, instead of becoming one rectangle that
+         * covers the screen.
+         */
+        QRect bounding;
+        for (auto& r: rects)
+            bounding |= r;
+
+        QRect cells[MERGE_GRID * MERGE_GRID];
+        for (auto& r: rects)
+        {
+            QPoint c = r.center() - bounding.topLeft();
+            int x = qint64(c.x()) * MERGE_GRID / bounding.width();
+            int y = qint64(c.y()) * MERGE_GRID / bounding.height();
+            cells[std::min(y, MERGE_GRID - 1) * MERGE_GRID + std::min(x, MERGE_GRID - 1)] |= r;
+        }
+
+        rects.clear();
+        for (auto& r: cells)
+            if (!r.isEmpty())
+                rects += r;
+    }
+
+    /*
+     * Repeatedly merge the pair that adds the least area that was not damaged.  Merging
+     * stops once there are few enough rectangles and every merge would add more than a
+     * quarter of the result.
+     *
+     * The waste of every pair is computed once, along with the best partner of each
+     * rectangle.  A merge only recomputes the pairs of the merged rectangle, and the best
+     * partners that were one of the two.  Each of those is a scan of all rectangles, so the
+     * worst case is O(n^3), although few partners change per merge in practice.  That is
+     * why n is bounded by MAX_MERGE_RECTS.
+     */
+    int n = rects.size();
+    std::vector<qint64> waste(n * n);
+    std::vector<int> partner(n, -1);
+    std::vector<bool> alive(n, true);
+
+    auto cost = [&rects](int i, int j) {
+        QRect u = rects[i] | rects[j];
+        return area(u) - area(rects[i]) - area(rects[j]) + area(rects[i] & rects[j]);
+    };
+
+    auto best = [&](int i) {
+        partner[i] = -1;
+        for (int j = 0; j < n; j++)
+        {
+            if (j == i || !alive[j])
+                continue;
+            if (partner[i] < 0 || waste[i * n + j] < waste[i * n + partner[i]])
+                partner[i] = j;
+        }
+    };
+
+    for (int i = 0; i < n; i++)
+        for (int j = i + 1; j < n; j++)
+            waste[i * n + j] = waste[j * n + i] = cost(i, j);
+
+    for (int i = 0; i < n; i++)
+        best(i);
+
+    for (int count = n; count > 1; count--)
+    {
+        int bi = -1;
+        for (int i = 0; i < n; i++)
+        {
+            if (!alive[i] || partner[i] < 0)
+                continue;
+            if (bi < 0 || waste[i * n + partner[i]] < waste[bi * n + partner[bi]])
+                bi = i;
+        }
+        int bj = partner[bi];
+
+        QRect u = rects[bi] | rects[bj];
+        if (count <= MAX_DAMAGE_RECTS && waste[bi * n + bj] * 4 > area(u))
+            break;
+
+        rects[bi] = u;
+        alive[bj] = false;
+
+        for (int k = 0; k < n; k++)
+            if (alive[k] && k != bi)
+                waste[k * n + bi] = waste[bi * n + k] = cost(bi, k);
+
+        for (int k = 0; k < n; k++)
+        {
+            if (!alive[k])
+                continue;
+            if (k == bi || partner[k] == bi || partner[k] == bj)
+                best(k);
+            else if (waste[k * n + bi] < waste[k * n + partner[k]])
+                partner[k] = bi;
+        }
+    }
+
+    QVector<QRect> merged;
+    for (int i = 0; i < n; i++)
+        if (alive[i])
+            merged += rects[i];
+
+    return merged;
 }
 
 void GraphicsPlaneView::paintEvent(QPaintEvent * event)
 {
     qDebug() << "GraphicsPlaneView::paintEvent " << event->region().boundingRect();
 
+    /*
+     * Render the exact damage, the backing store clips to it anyway.  Only the dirty
+     * rectangles passed on to the device are merged, when the frame is flushed.
+     */
+    for (const QRect& r: event->region())
+    {
+        m_damage += r;
+        m_damagedPixels += area(r);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
     QGraphicsView::paintEvent(event);
+
+    m_frameTime += (timer.nsecsElapsed() / 1000000.0 - m_frameTime) * 0.1;
+
+    LatencyTracker::instance().committed(LatencyTracker::Software);
+}
+
+void GraphicsPlaneView::flushDamage()
+{
+    if (m_damage.isEmpty())
+        return;
+
+    QVector<QRect> rects = merge(m_damage);
+    m_damage.clear();
+
+    if (!m_planes)
+        return;
+
+    /*
+     * The framebuffer covers the screen the window is on.
+     */
+    QRect screen(QPoint(0, 0), size());
+    if (window()->windowHandle() && window()->windowHandle()->screen())
+        screen = window()->windowHandle()->screen()->geometry();
+
+    std::vector<drm_clip_rect> clips;
+    clips.reserve(rects.size());
+    for (auto& r: rects)
+    {
+        QRect g(viewport()->mapToGlobal(r.topLeft()), r.size());
+        g = g.intersected(screen).translated(-screen.topLeft());
+        if (g.isEmpty())
+            continue;
+
+        drm_clip_rect clip;
+        clip.x1 = g.left();
+        clip.y1 = g.top();
+        clip.x2 = g.right() + 1;
+        clip.y2 = g.bottom() + 1;
+        clips.push_back(clip);
+    }
+
+    if (!clips.empty())
+        m_planes->dirtyFramebuffer(clips.data(), clips.size());
 }
 
 bool GraphicsPlaneView::eventFilter(QObject* object, QEvent* event)
@@ -35,7 +238,20 @@ bool GraphicsPlaneView::eventFilter(QObject* object, QEvent* event)
 bool GraphicsPlaneView::event(QEvent *event)
 {
     qDebug() << "GraphicsPlaneView::event " << event->type();
-    return QGraphicsView::event(event);
+
+    bool ret = QGraphicsView::event(event);
+
+    /*
+     * The backing store paints the viewport and flushes it to the framebuffer while
+     * handling the update request of the window.
+     */
+    if (event->type() == QEvent::UpdateRequest)
+    {
+        flushDamage();
+        LatencyTracker::instance().presented(LatencyTracker::Software);
+    }
+
+    return ret;
 }
 
 GraphicsPlaneView::~GraphicsPlaneView()
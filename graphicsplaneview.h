@@ -8,24 +8,71 @@
 #define GRAPHICSPLANEVIEW_H
 
 #include <QGraphicsView>
+#include <QRect>
+#include <QVector>
+
+class PlaneManager;
 
 /**
  * @brief The GraphicsPlaneView class
  *
  * An optimized GraphicsView for suporting a view containing a GraphicsPlaneItem.
+ *
+ * Software composition only touches what changed.  Qt renders the exact damage of each
+ * paint, and it is merged into a few rectangles that don't cover much more than it, which
+ * are passed on to the device as the dirty parts of the framebuffer.
  */
 class GraphicsPlaneView : public QGraphicsView
 {
 public:
-    GraphicsPlaneView(QGraphicsScene *scene);
+    /**
+     * @param scene
+     * @param planes Device to report dirty framebuffer rectangles to, if any.
+     */
+    GraphicsPlaneView(QGraphicsScene *scene, PlaneManager* planes = 0);
 
     virtual bool eventFilter(QObject* object, QEvent* event) override;
 
+    /**
+     * @brief Number of pixels rendered by Qt so far.
+     */
+    unsigned long long damagedPixels() const
+    {
+        return m_damagedPixels;
+    }
+
+    /**
+     * @brief Average time Qt takes to render a frame, in milliseconds.
+     */
+    double frameTime() const
+    {
+        return m_frameTime;
+    }
+
     virtual ~GraphicsPlaneView();
 
 protected:
     virtual void paintEvent(QPaintEvent * event) override;
     virtual bool event(QEvent *event) override;
+
+    /**
+     * @brief Merge rectangles so there are only a few, without growing much.
+     */
+    static QVector<QRect> merge(QVector<QRect> rects);
+
+    /**
+     * @brief Report the damage of the frame just flushed to the device.
+     */
+    void flushDamage();
+
+    PlaneManager* m_planes;
+
+    /**
+     * @brief Rectangles painted since the last flush, in viewport coordinates.
+     */
+    QVector<QRect> m_damage;
+    unsigned long long m_damagedPixels;
+    double m_frameTime;
 };
 
 #endif // GRAPHICSPLANEVIEW_H
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "huditem.h"
+#include "assetcache.h"
+#include <QFontMetrics>
+#include <QPainter>
+#include <algorithm>
+
+static const int MARGIN = 4;
+
+static QFont hudFont()
+{
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    font.setPointSize(8);
+    return font;
+}
+
+static QSize cellSize(const QFont& font)
+{
+    QFontMetrics metrics(font);
+    return QSize(metrics.maxWidth(), metrics.height());
+}
+
+HudItem::HudItem(PlaneManager& planes, struct plane_data* plane, int columns, int rows)
+    : GraphicsPlaneItem(planes, plane,
+                        QRectF(0, 0,
+                               columns * cellSize(hudFont()).width() + 2 * MARGIN,
+                               rows * cellSize(hudFont()).height() + 2 * MARGIN)),
+      m_font(hudFont()),
+      m_cellSize(cellSize(m_font)),
+      m_ascent(QFontMetrics(m_font).ascent()),
+      m_columns(columns),
+      m_rows(rows),
+      m_text(rows, QString(columns, QLatin1Char(' '))),
+      m_cells(0)
+{
+    setAcceptedMouseButtons(Qt::NoButton);
+
+    QSize size = m_bounding.size().toSize();
+    resizeBuffers(size.width(), size.height());
+    moveEvent(pos());
+
+    damage(QRegion(QRect(QPoint(0, 0), size)));
+    m_cells = columns * rows;
+    drawCells();
+}
+
+QRect HudItem::cell(int column, int row) const
+{
+    return QRect(MARGIN + column * m_cellSize.width(),
+                 MARGIN + row * m_cellSize.height(),
+                 m_cellSize.width(), m_cellSize.height());
+}
+
+void HudItem::setText(int row, const QString& text)
+{
+    if (row < 0 || row >= m_rows)
+        return;
+
+    QString line = text.left(m_columns).leftJustified(m_columns, QLatin1Char(' '));
+
+    QRegion changed;
+    for (int c = 0; c < m_columns; c++)
+    {
+        if (line[c] != m_text[row][c])
+        {
+            changed += cell(c, row);
+            m_cells++;
+        }
+    }
+
+    if (changed.isEmpty())
+        return;
+
+    m_text[row] = line;
+    damage(changed);
+    drawCells();
+}
+
+void HudItem::redraw()
+{
+    drawCells();
+}
+
+void HudItem::drawCells()
+{
+    /*
+     * This may run on the render worker, so work on a copy of the text.
+     */
+    std::vector<QString> text = m_text;
+    QFont font = m_font;
+    QSize cellSize = m_cellSize;
+    int ascent = m_ascent;
+    int columns = m_columns;
+    int rows = m_rows;
+
+    render([text, font, cellSize, ascent, columns, rows](QImage& fb, const QRegion& damaged) {
+        if (damaged.isEmpty())
+            return;
+
+        QPainter painter(&fb);
+        painter.setClipRegion(damaged);
+
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for (const QRect& r: damaged)
+            painter.fillRect(r, QColor(0, 0, 0, 160));
+
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        for (const QRect& r: damaged)
+        {
+            int c0 = std::max(0, (r.left() - MARGIN) / cellSize.width());
+            int c1 = std::min(columns - 1, (r.right() - MARGIN) / cellSize.width());
+            int r0 = std::max(0, (r.top() - MARGIN) / cellSize.height());
+            int r1 = std::min(rows - 1, (r.bottom() - MARGIN) / cellSize.height());
+
+            for (int row = r0; row <= r1; row++)
+            {
+                for (int c = c0; c <= c1; c++)
+                {
+                    QChar ch = text[row][c];
+                    if (ch == QLatin1Char(' '))
+                        continue;
+
+                    QImage glyph = AssetCache::instance().text(QString(ch), font, Qt::white);
+                    QPointF origin(MARGIN + c * cellSize.width(),
+                                   MARGIN + row * cellSize.height() + ascent);
+                    painter.drawImage(origin + glyph.offset(), glyph);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef HUDITEM_H
+#define HUDITEM_H
+
+#include "graphicsplaneitem.h"
+#include <QFont>
+#include <QSize>
+#include <QString>
+#include <vector>
+
+/**
+ * @brief The HudItem class
+ *
+ * A text display of a fixed number of rows and columns, for performance readouts, meant to
+ * be shown on a small plane of its own.
+ *
+ * Text is laid out in a grid of monospace glyph cells.  Setting a row only damages the
+ * cells whose character changed, and only those are rendered into the plane buffer, from
+ * glyphs rasterized once by the AssetCache.  Nothing of the Qt scene is repainted for it.
+ */
+class HudItem : public GraphicsPlaneItem
+{
+public:
+
+    /**
+     * @param planes
+     * @param plane Plane to show the text on, or null to have it composited by Qt.
+     * @param columns
+     * @param rows
+     */
+    HudItem(PlaneManager& planes, struct plane_data* plane, int columns, int rows);
+
+    /**
+     * @brief Set the text of a row, cut or padded to the number of columns.
+     */
+    void setText(int row, const QString& text);
+
+    /**
+     * @brief Number of glyph cells that changed so far.
+     */
+    unsigned long cellCount() const
+    {
+        return m_cells;
+    }
+
+protected:
+
+    virtual void redraw() override;
+
+    /**
+     * @brief Render the damaged cells.
+     */
+    void drawCells();
+
+    QRect cell(int column, int row) const;
+
+    QFont m_font;
+    QSize m_cellSize;
+    int m_ascent;
+    int m_columns;
+    int m_rows;
+
+    /**
+     * @brief Text of each row, always m_columns long.
+     */
+    std::vector<QString> m_text;
+
+    unsigned long m_cells;
+};
+
+#endif // HUDITEM_H
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "latencytracker.h"
+#include <cjson/cJSON.h>
+#include <cstdlib>
+#include <cstring>
+
+LatencyTracker& LatencyTracker::instance()
+{
+    static LatencyTracker tracker;
+    return tracker;
+}
+
+LatencyTracker::LatencyTracker()
+{
+    m_clock.start();
+    reset();
+}
+
+void LatencyTracker::reset()
+{
+    memset(m_pending, 0, sizeof(m_pending));
+    memset(m_committed, 0, sizeof(m_committed));
+    memset(m_histograms, 0, sizeof(m_histograms));
+}
+
+void LatencyTracker::input(Path path)
+{
+    Queue& q = m_pending[path];
+
+    // a flood of input that never gets committed only keeps the oldest events
+    if (q.size < MAX_PENDING)
+        q.times[q.size++] = m_clock.nsecsElapsed();
+}
+
+void LatencyTracker::committed(Path path)
+{
+    Queue& from = m_pending[path];
+    Queue& to = m_committed[path];
+
+    for (unsigned int i = 0; i < from.size && to.size < MAX_PENDING; i++)
+        to.times[to.size++] = from.times[i];
+
+    from.size = 0;
+}
+
+void LatencyTracker::presented(Path path)
+{
+    Queue& q = m_committed[path];
+    if (!q.size)
+        return;
+
+    int64_t now = m_clock.nsecsElapsed();
+    for (unsigned int i = 0; i < q.size; i++)
+        record(path, (now - q.times[i]) / 1000);
+
+    q.size = 0;
+}
+
+void LatencyTracker::record(Path path, uint64_t us)
+{
+    Histogram& h = m_histograms[path];
+
+    unsigned int bucket = us / BUCKET_US;
+    if (bucket >= BUCKETS)
+        bucket = BUCKETS - 1;
+
+    h.buckets[bucket]++;
+    if (!h.count || us < h.min)
+        h.min = us;
+    if (us > h.max)
+        h.max = us;
+    h.count++;
+    h.sum += us;
+}
+
+double LatencyTracker::percentile(Path path, double p) const
+{
+    const Histogram& h = m_histograms[path];
+    if (!h.count)
+        return 0;
+
+    unsigned long rank = (unsigned long)(p / 100.0 * h.count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long seen = 0;
+    for (unsigned int i = 0; i < BUCKETS; i++)
+    {
+        seen += h.buckets[i];
+        if (seen >= rank)
+        {
+            // upper edge of the bucket, but never above what was actually seen
+            uint64_t us = (uint64_t)(i + 1) * BUCKET_US;
+            if (us > h.max)
+                us = h.max;
+            return us / 1000.0;
+        }
+    }
+
+    return h.max / 1000.0;
+}
+
+std::string LatencyTracker::json() const
+{
+    static const char* names[PathCount] = { "plane", "software" };
+
+    cJSON* root = cJSON_CreateObject();
+
+    for (int p = 0; p < PathCount; p++)
+    {
+        const Histogram& h = m_histograms[p];
+        Path path = static_cast<Path>(p);
+
+        cJSON* o = cJSON_CreateObject();
+        cJSON_AddNumberToObject(o, "count", h.count);
+        cJSON_AddNumberToObject(o, "min_ms", h.count ? h.min / 1000.0 : 0);
+        cJSON_AddNumberToObject(o, "mean_ms", h.count ? h.sum / 1000.0 / h.count : 0);
+        cJSON_AddNumberToObject(o, "p50_ms", percentile(path, 50));
+        cJSON_AddNumberToObject(o, "p95_ms", percentile(path, 95));
+        cJSON_AddNumberToObject(o, "p99_ms", percentile(path, 99));
+        cJSON_AddNumberToObject(o, "max_ms", h.max / 1000.0);
+        cJSON_AddItemToObject(root, names[p], o);
+    }
+
+    char* text = cJSON_Print(root);
+    std::string result(text ? text : "{}");
+    free(text);
+    cJSON_Delete(root);
+
+    return result;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef LATENCYTRACKER_H
+#define LATENCYTRACKER_H
+
+#include <QElapsedTimer>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief The LatencyTracker class
+ *
+ * Measures the time from an input event until its result is on screen, separately for
+ * items shown on planes and items composited by Qt.
+ *
+ * Each path goes through three steps:
+ * - input() when the event reaches the item,
+ * - committed() when the frame with its result is sent to the display,
+ * - presented() when that frame is scanned out.
+ *
+ * Every input waiting at a commit gets the time of the following presentation.  Latencies
+ * are kept in histograms of 100 microsecond buckets.
+ */
+class LatencyTracker
+{
+public:
+
+    enum Path
+    {
+        Plane,
+        Software,
+        PathCount
+    };
+
+    /**
+     * @brief The tracker shared by the application.
+     */
+    static LatencyTracker& instance();
+
+    /**
+     * @brief An input event for the path was just handled.
+     */
+    void input(Path path);
+
+    /**
+     * @brief A frame of the path was sent to the display.
+     */
+    void committed(Path path);
+
+    /**
+     * @brief The last frame committed on the path is on screen.
+     */
+    void presented(Path path);
+
+    /**
+     * @brief Get a latency percentile in milliseconds.
+     * @param path
+     * @param p Percentile, from 0 to 100.
+     * @return 0 without samples.
+     */
+    double percentile(Path path, double p) const;
+
+    unsigned long count(Path path) const
+    {
+        return m_histograms[path].count;
+    }
+
+    /**
+     * @brief Statistics of all paths, as a JSON object.
+     */
+    std::string json() const;
+
+    /**
+     * @brief Forget all samples.
+     */
+    void reset();
+
+protected:
+
+    LatencyTracker();
+
+    static const unsigned int MAX_PENDING = 64;
+
+    /**
+     * @brief Bucket width, and number of buckets.  Anything longer goes in the last one.
+     */
+    static const unsigned int BUCKET_US = 100;
+    static const unsigned int BUCKETS = 2000;
+
+    struct Histogram
+    {
+        uint32_t buckets[BUCKETS];
+        unsigned long count;
+        uint64_t sum;
+        uint64_t min;
+        uint64_t max;
+    };
+
+    /**
+     * @brief Input times waiting for a commit, and committed ones waiting for scanout.
+     */
+    struct Queue
+    {
+        int64_t times[MAX_PENDING];
+        unsigned int size;
+    };
+
+    void record(Path path, uint64_t us);
+
+    QElapsedTimer m_clock;
+    Queue m_pending[PathCount];
+    Queue m_committed[PathCount];
+    Histogram m_histograms[PathCount];
+};
+
+#endif // LATENCYTRACKER_H
@@ -4,16 +4,28 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include "assetcache.h"
+#include "benchmark.h"
+#include "cpusampler.h"
 #include "planemanager.h"
 #include "graphicsplaneitem.h"
 #include "graphicsplaneview.h"
-#include "tools.h"
+#include "huditem.h"
+#include "latencytracker.h"
+#include "motionfilter.h"
+#include "planeallocator.h"
+#include "stresstest.h"
+#include "videoitem.h"
+#include <drm_fourcc.h>
 #include <cmath>
+#include <cstdio>
+#include <limits>
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QTimeLine>
-#include <QProgressBar>
 #include <QPropertyAnimation>
 #include <QStateMachine>
 #include <QSignalTransition>
@@ -28,8 +40,18 @@
 #include <QGridLayout>
 #include <QVector2D>
 #include <QGesture>
+#include <QScreen>
+#include <QStandardPaths>
 
 static auto GRIP_SIZE = 50;
+static auto ARROWS_SIZE_STEP = 16;
+static auto RESIZE_SETTLE_MS = 150;
+
+static QSize arrowsCacheSize(qreal size)
+{
+    int step = ((int)size + ARROWS_SIZE_STEP - 1) / ARROWS_SIZE_STEP * ARROWS_SIZE_STEP;
+    return QSize(step, step);
+}
 
 static void drawBox(QPainter *painter, bool focus, QRectF& bounding)
 {
@@ -42,26 +64,28 @@ static void drawBox(QPainter *painter, bool focus, QRectF& bounding)
     painter->fillRect(bounding, backColor);
 
     // Grip
-    static QImage grip(QImage(":/media/grip.png").scaled(GRIP_SIZE,
-                                                         GRIP_SIZE,
-                                                         Qt::KeepAspectRatio,
-                                                         Qt::SmoothTransformation));
+    QImage grip(AssetCache::instance().image(":/media/grip.png", QSize(GRIP_SIZE, GRIP_SIZE)));
     QRectF rect(bounding.width() - grip.width(),
                 bounding.height() - grip.height(),
                 grip.width(),
                 grip.height());
     painter->drawImage(rect, grip);
 
-    // Arrows
-    QImage arrows(QImage(":/media/arrows.png").scaled(std::min(bounding.width()/2,bounding.height()/2),
-                                                      std::min(bounding.width()/2,bounding.height()/2),
-                                                      Qt::KeepAspectRatio,
-                                                      Qt::SmoothTransformation));
-
-    QRectF rect2(bounding.width()/2 - arrows.width()/2,
-                 bounding.height()/2 - arrows.height()/2,
-                 arrows.width(),
-                 arrows.height());
+    /*
+     * Arrows
+     *
+     * The cached size is rounded up to a step so a resize drag does not smooth-scale a
+     * new image for every pixel.  The remainder is scaled by the painter, which is cheap.
+     */
+    qreal size = std::min(bounding.width()/2,bounding.height()/2);
+    QImage arrows(AssetCache::instance().image(":/media/arrows.png", arrowsCacheSize(size)));
+    QSizeF arrowsSize(arrows.size());
+    arrowsSize.scale(size, size, Qt::KeepAspectRatio);
+
+    QRectF rect2(bounding.width()/2 - arrowsSize.width()/2,
+                 bounding.height()/2 - arrowsSize.height()/2,
+                 arrowsSize.width(),
+                 arrowsSize.height());
     painter->drawImage(rect2, arrows);
 
 #ifdef ENABLE_OPACITY
@@ -90,14 +114,14 @@ static void drawBox(QPainter *painter, bool focus, QRectF& bounding)
 
 static void drawText(QPainter *painter, const char* text)
 {
-    QPen pen;
-    pen.setWidth(1);
-    pen.setColor(Qt::cyan);
-    painter->setPen(pen);
-    QFont font = painter->font() ;
-    font.setPointSize(8);
-    painter->setFont(font);
-    painter->drawText(QPointF(10,30), text);
+    static QFont font = []() {
+        QFont font;
+        font.setPointSize(8);
+        return font;
+    }();
+
+    QImage label(AssetCache::instance().text(text, font, Qt::cyan));
+    painter->drawImage(QPointF(10,30) + label.offset(), label);
 }
 
 class MyGraphicsItem : public QGraphicsObject
@@ -107,7 +131,8 @@ public:
         : QGraphicsObject(),
           m_bounding(bounding),
           m_resize(false),
-          m_gestureResize(false)
+          m_gestureResize(false),
+          m_motion([this](const QPointF& pos) { moveTo(pos); })
     {
         setFlags(flags() |
                  QGraphicsItem::ItemIsSelectable |
@@ -159,6 +184,9 @@ public:
                 m_distanceFromCenter = sqrt(pow(event->scenePos().x()-mapToScene(m_boundingOrig.center()).x(),2) +
                                             pow(event->scenePos().y()-mapToScene(m_boundingOrig.center()).y(),2));
             }
+
+            m_grab = event->scenePos() - pos();
+            m_motion.reset();
         }
 
         QGraphicsItem::mousePressEvent(event);
@@ -207,10 +235,35 @@ public:
 
     void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override
     {
-        if (m_resize && (event->buttons() & Qt::LeftButton))
+        LatencyTracker::instance().input(LatencyTracker::Software);
+
+        // coalesced down to one geometry change per frame, see moveTo()
+        if (event->buttons() & Qt::LeftButton)
+            m_motion.add(event->scenePos(), event->timestamp());
+        else
+            QGraphicsItem::mouseMoveEvent(event);
+    }
+
+    void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override
+    {
+        m_motion.flush();
+        m_resize = false;
+        QGraphicsItem::mouseReleaseEvent(event);
+    }
+
+    MotionFilter& motion()
+    {
+        return m_motion;
+    }
+
+private:
+
+    void moveTo(const QPointF& scenePos)
+    {
+        if (m_resize)
         {
-            qreal width = (m_boundingOrig.width()) + (event->scenePos().x() - m_offset.x());
-            qreal height = (m_boundingOrig.height()) + (event->scenePos().y() - m_offset.y());
+            qreal width = (m_boundingOrig.width()) + (scenePos.x() - m_offset.x());
+            qreal height = (m_boundingOrig.height()) + (scenePos.y() - m_offset.y());
 
             if (width > 0 && height > 0)
             {
@@ -221,19 +274,12 @@ public:
                                    height);
             }
         }
-        else
+        else if (flags() & QGraphicsItem::ItemIsMovable)
         {
-            QGraphicsItem::mouseMoveEvent(event);
+            setPos(scenePos - m_grab);
         }
     }
 
-    void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override
-    {
-        m_resize = false;
-        QGraphicsItem::mouseReleaseEvent(event);
-    }
-
-private:
     QPointF m_offset;
     QRectF m_bounding;
     QRectF m_boundingOrig;
@@ -241,47 +287,49 @@ private:
     qreal m_distanceFromCenter;
     bool m_gestureResize;
     qreal m_startScale;
+    QPointF m_grab;
+    MotionFilter m_motion;
 };
 
 class MyGraphicsPlaneItem : public GraphicsPlaneItem
 {
 public:
 
-    MyGraphicsPlaneItem(struct plane_data* plane, const QRectF& bounding)
-        : GraphicsPlaneItem(plane, bounding),
+    MyGraphicsPlaneItem(PlaneManager& planes, struct plane_data* plane, const QRectF& bounding)
+        : GraphicsPlaneItem(planes, plane, bounding),
           m_resize(false),
           m_focus(false),
-          m_fb(0),
-          m_painter(new QPainter),
-          m_gestureResize(false)
-
+          m_gestureResize(false),
+          m_motion([this](const QPointF& pos) { moveTo(pos); })
     {
         setFlag(QGraphicsItem::ItemIsSelectable);
-        setFlag(QGraphicsItem::ItemIsMovable);
 
-        m_dirty = QRectF(0,0,plane_width(m_plane), plane_height(m_plane));
+        // a grip drag resting this long gets its content rendered at the new size
+        m_settle.setSingleShot(true);
+        m_settle.setInterval(RESIZE_SETTLE_MS);
+        QObject::connect(&m_settle, &QTimer::timeout, [this]() { settle(); });
+        setFlag(QGraphicsItem::ItemIsMovable);
 
         grow(bounding);
+        damage(m_bounding.toAlignedRect());
 
-        draw(m_painter);
+        draw();
 
         grabGesture(Qt::PinchGesture);
     }
 
     void setSize(const QRectF& bounding)
     {
-        if (m_dirty.isNull())
-            m_dirty = m_bounding;
-        else
-            m_dirty = m_dirty.united(m_bounding);
-
         prepareGeometryChange();
 
         m_bounding = bounding;
 
         grow(bounding);
 
-        draw(m_painter);
+        // the box layout depends on its size
+        damage(m_bounding.toAlignedRect());
+
+        draw();
     }
 
     void update(const QRectF &rect = QRectF())
@@ -291,41 +339,53 @@ public:
         Q_UNUSED(rect);
     }
 
-    void reinit_painter()
+    void draw(bool async = false)
     {
-        if (m_fb)
-            delete m_fb;
+        qDebug() << "MyGraphicsPlaneItem::draw";
 
-        m_fb = new QImage(static_cast<uchar*>(m_plane->buf),
-                          plane_width(m_plane), plane_height(m_plane),
-                          QImage::Format_ARGB32_Premultiplied);
+        /*
+         * Render only what changed since the buffer was last rendered, straight into the
+         * mapped framebuffer.  This may run on the render worker, so work on a copy of the
+         * item state.
+         */
+        QRectF bounding = m_bounding;
+        bool focus = m_focus;
+        const char* label = plane() ? "Hardware" : "Software";
+
+        render([bounding, focus, label](QImage& fb, const QRegion& damaged) mutable {
+            if (damaged.isEmpty())
+                return;
+
+            QPainter painter(&fb);
+            painter.setClipRegion(damaged);
+
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            for (const QRect& r: damaged)
+                painter.fillRect(r, Qt::transparent);
+
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            drawBox(&painter, focus, bounding);
+            drawText(&painter, label);
+        }, async);
     }
 
-    void draw(QPainter* painter)
+    /*
+     * Render the content at the size the grip was dragged to, off the GUI thread.  Until it
+     * is presented, the stretched preview stays on screen.
+     */
+    void settle()
     {
-        qDebug() << "MyGraphicsPlaneItem::draw";
-
-        QImage buffer(boundingRect().united(m_dirty).size().toSize(),
-                      QImage::Format_ARGB32_Premultiplied);
-        buffer.fill(Qt::transparent);
-
-        QPainter painter2(&buffer);
-
-        if (!m_dirty.isNull())
-        {
-            painter2.fillRect(m_dirty, Qt::transparent);
-            m_dirty = QRectF();
-        }
+        m_settle.stop();
 
-        painter2.setClipRect(boundingRect());
+        grow(m_bounding);
+        damage(m_bounding.toAlignedRect());
 
-        drawBox(&painter2, m_focus, m_bounding);
-        drawText(&painter2, "Hardware");
+        draw(true);
+    }
 
-        painter->begin(m_fb);
-        painter->setCompositionMode(QPainter::CompositionMode_Source);
-        painter->drawImage(0,0,buffer);
-        painter->end();
+    void redraw() override
+    {
+        draw();
     }
 
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override
@@ -349,6 +409,9 @@ public:
                 m_distanceFromCenter = sqrt(pow(event->scenePos().x()-mapToScene(m_boundingOrig.center()).x(),2) +
                                             pow(event->scenePos().y()-mapToScene(m_boundingOrig.center()).y(),2));
             }
+
+            m_grab = event->scenePos() - pos();
+            m_motion.reset();
         }
 
         GraphicsPlaneItem::mousePressEvent(event);
@@ -356,35 +419,20 @@ public:
 
     void grow(const QRectF& bounding)
     {
-        if ((int)plane_width(m_plane) != bounding.width() || (int)plane_height(m_plane) != bounding.height())
+        if (bufferSize() != bounding.size().toSize())
         {
-            QRectF bigger(0, 0,
-#if 1
-                          bounding.width(),
-                          bounding.height()
-#else
-                          bounding.width() + (bounding.width() * 0.25),
-                          bounding.height() + (bounding.height() * 0.25)
-#endif
-                          );
+            /*
+             * The framebuffer pool rounds up to size classes with slack, so most resizes
+             * reuse the current buffers and only change the plane source rectangle.
+             */
+            QRectF bigger(0, 0, bounding.width(), bounding.height());
 
             qDebug() << "resize fb to " << bigger.width() << "," << bigger.height();
 
-            plane_fb_reallocate(m_plane,
-                                bigger.width(),
-                                bigger.height(),
-                                plane_format(m_plane));
-
-            plane_fb_map(m_plane);
-            reinit_painter();
+            resizeBuffers(bigger.width(), bigger.height());
 
             // must reset position after fb reallocate
             moveEvent(pos());
-
-            if (m_dirty.isNull())
-                m_dirty = bigger;
-            else
-                m_dirty = m_dirty.united(bigger);
         }
     }
 
@@ -433,58 +481,34 @@ public:
 
     void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override
     {
-        if (m_resize && (event->buttons() & Qt::LeftButton))
-        {
-            qreal width = (m_boundingOrig.width()) + (event->scenePos().x() - m_offset.x());
-            qreal height = (m_boundingOrig.height()) + (event->scenePos().y() - m_offset.y());
+        LatencyTracker::instance().input(plane() ? LatencyTracker::Plane :
+                                         LatencyTracker::Software);
 
-            if (width > 0 && height > 0)
-            {
-                prepareGeometryChange();
-                m_bounding.setRect(m_boundingOrig.x(),
-                                   m_boundingOrig.y(),
-                                   width,
-                                   height);
-            }
-        }
+        // coalesced down to one geometry change per frame, see moveTo()
+        if (event->buttons() & Qt::LeftButton)
+            m_motion.add(event->scenePos(), event->timestamp());
         else
-        {
             GraphicsPlaneItem::mouseMoveEvent(event);
-        }
+    }
+
+    MotionFilter& motion()
+    {
+        return m_motion;
     }
 
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override
     {
+        m_motion.flush();
+
         if (m_resize)
         {
-            grow(m_bounding);
-
-            if (m_boundingOrig.width() > m_bounding.width() ||
-                    m_boundingOrig.height() > m_bounding.height())
-            {
-                if (m_dirty.isNull())
-                    m_dirty = m_boundingOrig;
-                else
-                    m_dirty = m_dirty.united(m_boundingOrig);
-            }
-
-            draw(m_painter);
-
+            settle();
             m_resize = false;
         }
 
         GraphicsPlaneItem::mouseReleaseEvent(event);
     }
 
-    virtual ~MyGraphicsPlaneItem()
-    {
-        if (m_painter)
-            delete m_painter;
-
-        if (m_fb)
-            delete m_fb;
-    }
-
 protected:
 
     virtual QVariant itemChange(GraphicsItemChange change, const QVariant &value) override
@@ -492,23 +516,114 @@ protected:
         if (change == GraphicsItemChange::ItemSelectedHasChanged)
         {
             m_focus = value.toBool();
-            draw(m_painter);
+
+            // only the focus border changes
+            QRect r = m_bounding.toAlignedRect();
+            damage(QRegion(r) - QRegion(r.adjusted(1, 1, -1, -1)));
+
+            draw();
         }
 
         return GraphicsPlaneItem::itemChange(change, value);
     }
 
 private:
+
+    void moveTo(const QPointF& scenePos)
+    {
+        if (m_resize)
+        {
+            qreal width = (m_boundingOrig.width()) + (scenePos.x() - m_offset.x());
+            qreal height = (m_boundingOrig.height()) + (scenePos.y() - m_offset.y());
+
+            if (width > 0 && height > 0)
+            {
+                prepareGeometryChange();
+                m_bounding.setRect(m_boundingOrig.x(),
+                                   m_boundingOrig.y(),
+                                   width,
+                                   height);
+
+                // preview by stretching what is on screen, nothing is rendered until settle()
+                stretch(m_bounding.size());
+                m_settle.start();
+            }
+        }
+        else if (flags() & QGraphicsItem::ItemIsMovable)
+        {
+            setPos(scenePos - m_grab);
+        }
+    }
+
     QPointF m_offset;
     QRectF m_boundingOrig;
     bool m_resize;
     bool m_focus;
-    QRectF m_dirty;
-    QImage* m_fb;
-    QPainter* m_painter;
     qreal m_distanceFromCenter;
     bool m_gestureResize;
     qreal m_startScale;
+    QPointF m_grab;
+    MotionFilter m_motion;
+    QTimer m_settle;
+};
+
+/*
+ * The view background, on a plane of its own below the Qt framebuffer.  It is written
+ * once, after that Qt never blends it again under moving items.
+ */
+class BackgroundItem : public GraphicsPlaneItem
+{
+public:
+
+    BackgroundItem(PlaneManager& planes, struct plane_data* plane, const QImage& image)
+        : GraphicsPlaneItem(planes, plane, QRectF(QPointF(0, 0), image.size()))
+    {
+        // the lowest zValue also puts the plane at the bottom, if its zpos can be changed
+        setZValue(std::numeric_limits<qreal>::lowest());
+        setAcceptedMouseButtons(Qt::NoButton);
+
+        draw(plane, image, false, false, false);
+    }
+};
+
+/**
+ * @brief An item declared in the screen config, on a plane of its own.
+ *
+ * Clicking the item raises it above the other config items it overlaps.  Only the zpos of
+ * the planes changes, nothing is rendered again.
+ */
+class SceneItem : public GraphicsPlaneItem
+{
+public:
+
+    SceneItem(PlaneManager& planes, struct plane_data* plane, const QImage& image)
+        : GraphicsPlaneItem(planes, plane, QRectF(QPointF(0, 0), image.size()))
+    {
+        setFlag(QGraphicsItem::ItemIsMovable);
+
+        draw(plane, image, false, false, false);
+    }
+
+protected:
+
+    void mousePressEvent(QGraphicsSceneMouseEvent* event) override
+    {
+        qreal top = zValue();
+        bool below = false;
+        for (auto item: collidingItems())
+        {
+            if (dynamic_cast<SceneItem*>(item) && item->zValue() >= top)
+            {
+                top = item->zValue();
+                below = true;
+            }
+        }
+
+        if (below)
+            setZValue(top + 1);
+
+        GraphicsPlaneItem::mousePressEvent(event);
+    }
 };
 
 #ifdef ALL_SOFTWARE
@@ -522,18 +637,22 @@ public:
 #ifdef ALL_SOFTWARE
         : QGraphicsView(scene)
 #else
-        : GraphicsPlaneView(scene)
+        : GraphicsPlaneView(scene, &planes)
 #endif
     {
+        m_video = 0;
+
         m_box1 = new MyGraphicsItem(QRectF(0,0,50,50));
         scene->addItem(m_box1);
 #ifdef ALL_SOFTWARE
         m_box2 = new MyGraphicsItem(QRectF(0,0,50,50));
         scene->addItem(m_box2);
 #else
-        m_box2 = new MyGraphicsPlaneItem(planes.get("overlay1"),
-                                       QRectF(0,0,50,50));
+        // composited by Qt until the allocator gives it a plane
+        m_box2 = new MyGraphicsPlaneItem(planes, 0, QRectF(0,0,50,50));
         scene->addItem(m_box2);
+
+        m_allocator.reset(new PlaneAllocator(planes, scene));
 #endif
 
         viewport()->grabGesture(Qt::TapAndHoldGesture);
@@ -553,6 +672,63 @@ public:
                        height()/2 - m_box2->boundingRect().height()/2);
     }
 
+    /**
+     * @brief Set how both boxes coalesce and predict drags.
+     */
+    void setMotion(bool coalesce, int horizon)
+    {
+        qreal rate = QGuiApplication::primaryScreen()->refreshRate();
+        int period = rate > 0 ? qRound(1000.0 / rate) : 16;
+
+        m_box1->motion().setFramePeriod(period);
+        m_box2->motion().setFramePeriod(period);
+        m_box1->motion().setCoalesce(coalesce);
+        m_box1->motion().setHorizon(horizon);
+        m_box2->motion().setCoalesce(coalesce);
+        m_box2->motion().setHorizon(horizon);
+    }
+
+    /**
+     * @brief Set the video item whose stats are printed with the latency report.
+     */
+    void setVideo(VideoItem* video)
+    {
+        m_video = video;
+    }
+
+    /**
+     * @brief Set a function called once the view has painted its first frame.
+     */
+    void setFirstFrameHandler(const std::function<void()>& handler)
+    {
+        m_firstFrame = handler;
+    }
+
+    QGraphicsItem* box1() const
+    {
+        return m_box1;
+    }
+
+    QGraphicsItem* box2() const
+    {
+        return m_box2;
+    }
+
+    /**
+     * @brief Stop moving planes around, and give box2 a plane for good.
+     *
+     * Benchmark runs then always measure the same path, whatever the allocator would have
+     * decided while they run.
+     */
+    void pinPlanes()
+    {
+#ifndef ALL_SOFTWARE
+        m_allocator.reset();
+        if (!m_box2->plane())
+            m_box2->setPlane(m_planes->acquirePlane());
+#endif
+    }
+
     bool tapAndHoldTriggered(QTapAndHoldGesture * tap)
     {
         switch (tap->state())
@@ -594,10 +770,37 @@ public:
         if(k->key() == 48){
             QApplication::instance()->exit();
         }
+        else if (k->key() == Qt::Key_L)
+        {
+            // input to scanout latency of both paths, and how well motion is predicted
+            std::string json = LatencyTracker::instance().json();
+            fprintf(stdout, "%s\n", json.c_str());
+            fprintf(stdout, "{\"motion\":{\"box1\":%s,\"box2\":%s}}\n",
+                    m_box1->motion().json().c_str(), m_box2->motion().json().c_str());
+            if (m_video)
+                fprintf(stdout, "{\"video\":%s}\n", m_video->json().c_str());
+            fflush(stdout);
+        }
     }
 
 protected:
 
+    void paintEvent(QPaintEvent* event) override
+    {
+#ifdef ALL_SOFTWARE
+        QGraphicsView::paintEvent(event);
+#else
+        GraphicsPlaneView::paintEvent(event);
+#endif
+
+        if (m_firstFrame)
+        {
+            auto handler = m_firstFrame;
+            m_firstFrame = nullptr;
+            handler();
+        }
+    }
+
     bool viewportEvent(QEvent *event) override
     {
         qDebug() << "viewportEvent " << event;
@@ -622,16 +825,83 @@ private:
     MyGraphicsItem* m_box2;
 #else
     MyGraphicsPlaneItem* m_box2;
+    std::unique_ptr<PlaneAllocator> m_allocator;
 #endif
+    VideoItem* m_video;
+    std::function<void()> m_firstFrame;
 };
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startup;
+    startup.start();
+
     QApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption benchmarkOption("benchmark",
+                                       "Replay gestures on both boxes and print a report.");
+    QCommandLineOption scriptOption("script", "Gesture script to replay.", "file");
+    QCommandLineOption rateOption("rate", "Events per second to replay at.", "hz");
+    QCommandLineOption recordOption("record", "Record mouse gestures to a script.", "file");
+    QCommandLineOption stressOption("stress",
+                                    "Add up to the given number of animated software and plane"
+                                    " items, and print the throughput at each step.",
+                                    "software,plane");
+    parser.addOption(benchmarkOption);
+    parser.addOption(scriptOption);
+    parser.addOption(rateOption);
+    parser.addOption(recordOption);
+    QCommandLineOption predictOption("predict",
+                                     "Place dragged boxes where the pointer is predicted to be"
+                                     " this many milliseconds ahead.", "ms", "0");
+    QCommandLineOption noCoalesceOption("no-coalesce",
+                                        "Handle every move event instead of one per frame.");
+    QCommandLineOption videoOption("video",
+                                   "Play a directory of images, or a file of raw frames, in a"
+                                   " loop.", "path");
+    QCommandLineOption videoRawOption("video-raw",
+                                      "Size and DRM fourcc of the raw frames, for example"
+                                      " 640x480:NV12.", "size:fourcc");
+    QCommandLineOption fpsOption("fps", "Frame rate of the video.", "fps", "30");
+    parser.addOption(stressOption);
+    parser.addOption(predictOption);
+    parser.addOption(noCoalesceOption);
+    parser.addOption(videoOption);
+    parser.addOption(videoRawOption);
+    parser.addOption(fpsOption);
+    parser.process(app);
+
+    bool benchmark = parser.isSet(benchmarkOption);
+    bool stress = parser.isSet(stressOption);
+
+    QRect screen = QApplication::desktop()->screenGeometry();
+
+    /*
+     * Decode and scale the assets of the first frame on a thread pool while the planes load.
+     * Scaled assets are kept on disk, so a warm start only reads them back.  Whatever is
+     * still being prepared when it is first used is waited for.
+     */
+    AssetCache& assets = AssetCache::instance();
+    assets.setDiskCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+                        "/assets");
+    assets.preload(":/media/background.png", screen.size());
+    assets.preload(":/media/logo.png");
+    assets.preload(":/media/grip.png", QSize(GRIP_SIZE, GRIP_SIZE));
+    // boxes start at 30% of the screen width, see MyGraphicsView::positionBoxes()
+    assets.preload(":/media/arrows.png", arrowsCacheSize(screen.width() * 0.3 / 2));
+
+    QElapsedTimer planesTime;
+    planesTime.start();
+
     PlaneManager planes;
 #ifndef ALL_SOFTWARE
-    if (!planes.load("qtviewplanes.screen"))
+    /*
+     * A benchmark or stress test may run without planes, for example with the offscreen
+     * platform.  Plane items are then composited by Qt.
+     */
+    if (!planes.load("qtviewplanes.screen") && !benchmark && !stress)
     {
         QMessageBox::critical(0, "Failed to Setup Planes",
                               "This demo requires a version of Qt that provides access to the DRI file descriptor,"
@@ -640,7 +910,7 @@ int main(int argc, char *argv[])
         return -1;
     }
 #endif
-    QRect screen = QApplication::desktop()->screenGeometry();
+    qint64 planesMs = planesTime.elapsed();
 
     QGraphicsScene scene;
 
@@ -649,7 +919,7 @@ int main(int argc, char *argv[])
      * translate to hardware plane usage behind the scenes.
      */
 
-    QGraphicsPixmapItem* logo = new QGraphicsPixmapItem(QPixmap(":/media/logo.png"));
+    QGraphicsPixmapItem* logo = new QGraphicsPixmapItem(QPixmap::fromImage(assets.image(":/media/logo.png")));
     logo->setPos(10, 10);
     scene.addItem(logo);
 
@@ -659,21 +929,40 @@ int main(int argc, char *argv[])
     text->setPlainText("Qt Graphics View Framework + libplanes");
     scene.addItem(text);
 
-    QProgressBar* progress = new QProgressBar();
-    progress->setOrientation(Qt::Horizontal);
-    progress->setRange(0, 100);
-    progress->setTextVisible(true);
-    progress->setAlignment(Qt::AlignCenter);
-    progress->setFormat("CPU: %p%");
-    progress->setValue(0);
-    QPalette p = progress->palette();
-    p.setColor(QPalette::WindowText, Qt::white);
-    p.setColor(QPalette::Highlight, Qt::red);
-    p.setBrush(QPalette::Background, Qt::transparent);
-    progress->setPalette(p);
-    progress->setMaximumWidth(200);
-    QGraphicsProxyWidget *proxy = scene.addWidget(progress);
-    proxy->setPos(screen.width() - progress->width() - 10, 10);
+    /*
+     * Performance readouts go on a plane of their own when the config has one, so
+     * measuring doesn't make Qt repaint anything.
+     */
+    HudItem* hud = new HudItem(planes, planes.hudPlane(), 20, 3);
+    hud->setPos(screen.width() - hud->boundingRect().width() - 10, 10);
+    hud->setZValue(std::numeric_limits<qreal>::max());
+    scene.addItem(hud);
+
+    /*
+     * Items declared in the screen config, one per plane.
+     */
+    for (auto plane: planes.itemPlanes())
+    {
+        const PlaneItemOptions& options = planes.options(plane).item;
+        QSize size(options.width ? options.width : plane_width(plane),
+                   options.height ? options.height : plane_height(plane));
+
+        QImage content;
+        if (!options.image.empty())
+            content = assets.image(QString::fromStdString(options.image), size,
+                                   Qt::IgnoreAspectRatio);
+        if (content.isNull())
+        {
+            content = QImage(size, QImage::Format_ARGB32_Premultiplied);
+            content.fill(options.color.empty() ? QColor("#526d74") :
+                         QColor(QString::fromStdString(options.color)));
+        }
+
+        SceneItem* item = new SceneItem(planes, plane, content);
+        item->setPos(options.x, options.y);
+        item->setZValue(options.z);
+        scene.addItem(item);
+    }
 
     /*
      * Setup the view.
@@ -681,28 +970,145 @@ int main(int argc, char *argv[])
 
     MyGraphicsView view(&scene, planes);
     view.setStyleSheet("QGraphicsView { border-style: none; }");
-    QPixmap background(":/media/background.png");
-    view.setBackgroundBrush(background.scaled(screen.width(),
-                                              screen.height(),
-                                              Qt::KeepAspectRatio,
-                                              Qt::SmoothTransformation));
-    view.setCacheMode(QGraphicsView::CacheBackground);
+    QImage background = assets.image(":/media/background.png", screen.size());
+#ifndef ALL_SOFTWARE
+    if (struct plane_data* plane = planes.backgroundPlane())
+    {
+        /*
+         * Qt only composites what is on top of the background plane.  Damage is cleared to
+         * transparent instead of being blended over the background again.
+         */
+        scene.addItem(new BackgroundItem(planes, plane, background));
+        view.setAttribute(Qt::WA_TranslucentBackground);
+    }
+    else
+#endif
+    {
+        view.setBackgroundBrush(QPixmap::fromImage(background));
+        view.setCacheMode(QGraphicsView::CacheBackground);
+    }
     view.resize(screen.width(), screen.height());
     view.setSceneRect(0, 0, screen.width(), screen.height());
     view.setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     view.setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     view.positionBoxes();
+    view.setMotion(!parser.isSet(noCoalesceOption), parser.value(predictOption).toInt());
+    view.setFirstFrameHandler([&startup, &assets, planesMs]() {
+        qint64 ms = startup.elapsed();
+        qDebug() << "first frame after " << ms << " ms";
+        fprintf(stdout, "{\"startup\":{\"first_frame_ms\":%lld,\"planes_ms\":%lld,"
+                "\"asset_misses\":%lu,\"asset_disk_hits\":%lu}}\n",
+                (long long)ms, (long long)planesMs, assets.misses(), assets.diskHits());
+        fflush(stdout);
+    });
     view.show();
 
+    if (benchmark)
+    {
+        Benchmark bench(&view, planes);
+        if (parser.isSet(scriptOption) && !bench.load(parser.value(scriptOption)))
+        {
+            qWarning() << "failed to load " << parser.value(scriptOption);
+            return -1;
+        }
+        if (parser.isSet(rateOption))
+            bench.setRate(parser.value(rateOption).toInt());
+        bench.setReset([&view]() { view.positionBoxes(); });
+        view.pinPlanes();
+
+        bench.run("MyGraphicsItem", view.box1());
+        bench.run("MyGraphicsPlaneItem", view.box2());
+
+        std::string json = bench.report();
+        fprintf(stdout, "%s\n", json.c_str());
+        fflush(stdout);
+
+        return 0;
+    }
+
+    std::unique_ptr<StressTest> stressTest;
+    if (stress)
+    {
+        QStringList counts = parser.value(stressOption).split(',');
+        stressTest.reset(new StressTest(&view, planes, counts.value(0).toInt(),
+                                        counts.value(1).toInt()));
+        stressTest->setSoftwareFactory([](const QRectF& bounding) {
+            return new MyGraphicsItem(bounding);
+        });
+        stressTest->setPlaneFactory([&planes](struct plane_data* plane, const QRectF& bounding) {
+            return new MyGraphicsPlaneItem(planes, plane, bounding);
+        });
+        stressTest->setResize([](QGraphicsObject* item, const QRectF& bounding) {
+            if (MyGraphicsItem* i = dynamic_cast<MyGraphicsItem*>(item))
+                i->setSize(bounding);
+            else if (MyGraphicsPlaneItem* i = dynamic_cast<MyGraphicsPlaneItem*>(item))
+                i->setSize(bounding);
+        });
+        stressTest->start();
+    }
+
     /*
-     * Update the progress bar independently.
+     * A video stream is the load planes pay off for.  It gets a plane of its own if the
+     * allocator has one left, and is composited by Qt otherwise.
      */
+    if (parser.isSet(videoOption))
+    {
+        QSize rawSize;
+        uint32_t rawFormat = 0;
+        if (parser.isSet(videoRawOption))
+        {
+            QStringList raw = parser.value(videoRawOption).split(':');
+            QStringList size = raw.value(0).split('x');
+            rawSize = QSize(size.value(0).toInt(), size.value(1).toInt());
+            QByteArray fourcc = raw.value(1).toLatin1().leftJustified(4, ' ');
+            rawFormat = fourcc_code(fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+        }
 
-    Tools tools;
+        VideoItem* video = new VideoItem(planes, planes.acquirePlane());
+        scene.addItem(video);
+        if (!video->play(parser.value(videoOption), parser.value(fpsOption).toDouble(),
+                         rawSize, rawFormat))
+        {
+            qWarning() << "failed to play " << parser.value(videoOption);
+            return -1;
+        }
+        video->setPos(screen.width() - video->boundingRect().width() - 10,
+                      screen.height() - video->boundingRect().height() - 10);
+        view.setVideo(video);
+    }
+
+    std::unique_ptr<Benchmark> recorder;
+    if (parser.isSet(recordOption))
+    {
+        recorder.reset(new Benchmark(&view, planes));
+        recorder->record(parser.value(recordOption));
+    }
+
+    /*
+     * Update the readouts independently.
+     */
+
+    CpuSampler cpu;
     QTimer cpuTimer;
-    QObject::connect(&cpuTimer, &QTimer::timeout, [&tools,&progress]() {
-        tools.updateCpuUsage();
-        progress->setValue(tools.cpu_usage[0]);
+    QElapsedTimer commitClock;
+    unsigned long commits = planes.commitCount();
+    commitClock.start();
+    QObject::connect(&cpuTimer, &QTimer::timeout, [&]() {
+        cpu.sample();
+
+        CpuSampler::Snapshot s = cpu.snapshot();
+        hud->setText(0, QString("CPU %1% app %2%")
+                     .arg(qRound(s.total), 3).arg(qRound(s.process), 3));
+
+#ifndef ALL_SOFTWARE
+        hud->setText(1, QString("frame %1 ms").arg(view.frameTime(), 5, 'f', 1));
+#endif
+
+        double seconds = commitClock.restart() / 1000.0;
+        unsigned long count = planes.commitCount();
+        if (seconds > 0)
+            hud->setText(2, QString("commits %1/s").arg(qRound((count - commits) / seconds), 4));
+        commits = count;
     });
     cpuTimer.start(500);
 
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "motionfilter.h"
+#include <cjson/cJSON.h>
+#include <QLineF>
+#include <algorithm>
+#include <cstdlib>
+
+/**
+ * @brief Samples further apart than this are a new motion, the velocity starts over.
+ */
+static const qint64 MAX_SAMPLE_GAP = 100;
+
+MotionFilter::MotionFilter(const ApplyFunction& apply)
+    : m_apply(apply),
+      m_coalesce(true),
+      m_horizon(0),
+      m_alpha(0.5),
+      m_period(16),
+      m_pending(false),
+      m_hasSample(false),
+      m_timestamp(0),
+      m_arrival(0),
+      m_lastApply(-1),
+      m_predictionCount(0),
+      m_samples(0),
+      m_applied(0),
+      m_measured(0),
+      m_predictedError(0),
+      m_rawError(0),
+      m_predictedMax(0),
+      m_rawMax(0)
+{
+    m_clock.start();
+
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, [this]() { apply(true); });
+}
+
+void MotionFilter::add(const QPointF& pos, qint64 timestamp)
+{
+    qint64 arrival = m_clock.elapsed();
+
+    m_samples++;
+    measure(pos, arrival);
+
+    if (m_hasSample)
+    {
+        qint64 dt = timestamp - m_timestamp;
+        if (dt > MAX_SAMPLE_GAP || dt < 0)
+            m_velocity = QPointF();
+        else if (dt > 0)
+            m_velocity = m_alpha * (pos - m_pos) / dt + (1.0 - m_alpha) * m_velocity;
+    }
+
+    m_pos = pos;
+    m_timestamp = timestamp;
+    m_arrival = arrival;
+    m_hasSample = true;
+    m_pending = true;
+
+    if (!m_coalesce)
+    {
+        apply(true);
+        return;
+    }
+
+    if (m_timer.isActive())
+        return;
+
+    /*
+     * Apply right away if nothing was applied for a frame, still through the event loop so
+     * events already queued are coalesced.  Otherwise wait for the next frame.
+     */
+    qint64 wait = m_lastApply < 0 ? 0 : m_lastApply + m_period - arrival;
+    m_timer.start(std::max<qint64>(0, wait));
+}
+
+void MotionFilter::flush()
+{
+    m_timer.stop();
+    apply(false);
+
+    // the pointer stopped, nothing predicted past this will be reached
+    m_predictionCount = 0;
+}
+
+void MotionFilter::reset()
+{
+    m_timer.stop();
+    m_pending = false;
+    m_hasSample = false;
+    m_velocity = QPointF();
+    m_predictionCount = 0;
+}
+
+void MotionFilter::apply(bool predict)
+{
+    if (!m_pending)
+        return;
+
+    m_pending = false;
+
+    qint64 now = m_clock.elapsed();
+    QPointF pos = m_pos;
+
+    if (predict && m_horizon > 0)
+    {
+        // from the newest sample to the time the frame is on screen
+        qint64 lead = now - m_arrival + m_horizon;
+        pos += m_velocity * lead;
+
+        if (m_predictionCount == MAX_PREDICTIONS)
+        {
+            std::copy(m_predictions + 1, m_predictions + MAX_PREDICTIONS, m_predictions);
+            m_predictionCount--;
+        }
+        m_predictions[m_predictionCount++] = {now + m_horizon, pos, m_pos};
+    }
+
+    m_lastApply = now;
+    m_applied++;
+
+    m_apply(pos);
+}
+
+void MotionFilter::measure(const QPointF& pos, qint64 arrival)
+{
+    if (!m_hasSample || arrival <= m_arrival)
+        return;
+
+    unsigned int done = 0;
+    while (done < m_predictionCount && m_predictions[done].target <= arrival)
+    {
+        const Prediction& p = m_predictions[done++];
+
+        // where the pointer was at the target time, between the last two samples
+        qreal t = qBound<qreal>(0.0, qreal(p.target - m_arrival) / (arrival - m_arrival), 1.0);
+        QPointF actual = m_pos + (pos - m_pos) * t;
+
+        double predicted = QLineF(p.predicted, actual).length();
+        double raw = QLineF(p.raw, actual).length();
+
+        m_measured++;
+        m_predictedError += predicted;
+        m_rawError += raw;
+        m_predictedMax = std::max(m_predictedMax, predicted);
+        m_rawMax = std::max(m_rawMax, raw);
+    }
+
+    std::copy(m_predictions + done, m_predictions + m_predictionCount, m_predictions);
+    m_predictionCount -= done;
+}
+
+std::string MotionFilter::json() const
+{
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "samples", m_samples);
+    cJSON_AddNumberToObject(root, "applied", m_applied);
+    cJSON_AddNumberToObject(root, "horizon_ms", m_horizon);
+    cJSON_AddNumberToObject(root, "measured", m_measured);
+    cJSON_AddNumberToObject(root, "predicted_error_px",
+                            m_measured ? m_predictedError / m_measured : 0);
+    cJSON_AddNumberToObject(root, "predicted_error_max_px", m_predictedMax);
+    cJSON_AddNumberToObject(root, "raw_error_px", m_measured ? m_rawError / m_measured : 0);
+    cJSON_AddNumberToObject(root, "raw_error_max_px", m_rawMax);
+
+    char* text = cJSON_PrintUnformatted(root);
+    std::string result(text ? text : "{}");
+    free(text);
+    cJSON_Delete(root);
+
+    return result;
+}
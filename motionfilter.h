@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef MOTIONFILTER_H
+#define MOTIONFILTER_H
+
+#include <QElapsedTimer>
+#include <QPointF>
+#include <QTimer>
+#include <functional>
+#include <string>
+
+/**
+ * @brief The MotionFilter class
+ *
+ * Coalesces move events of a drag down to one per frame, and optionally predicts where the
+ * pointer will be when the frame is scanned out.
+ *
+ * Samples are given to add() as they arrive.  At most once per frame period the apply
+ * function is called with the newest one, so events arriving within a frame cost a single
+ * geometry change.
+ *
+ * With a horizon set, the position passed to apply is extrapolated that far past the
+ * newest sample, from a smoothed velocity computed with the event timestamps.  The error of
+ * every prediction is measured once the real pointer gets there, together with the error
+ * of the raw sample that would have been used without prediction.
+ */
+class MotionFilter : public QObject
+{
+public:
+
+    typedef std::function<void(const QPointF& pos)> ApplyFunction;
+
+    MotionFilter(const ApplyFunction& apply);
+
+    /**
+     * @brief Add a sample.
+     * @param pos Scene position.
+     * @param timestamp Event timestamp in milliseconds.
+     */
+    void add(const QPointF& pos, qint64 timestamp);
+
+    /**
+     * @brief Apply the newest sample now, without prediction.
+     *
+     * Call this when the drag ends, so the item stops where the pointer did.
+     */
+    void flush();
+
+    /**
+     * @brief Forget the velocity, call this when a drag starts.
+     */
+    void reset();
+
+    /**
+     * @brief Apply every sample as it arrives when disabled.
+     */
+    void setCoalesce(bool enable)
+    {
+        m_coalesce = enable;
+    }
+
+    /**
+     * @brief How far ahead to predict in milliseconds, 0 to disable prediction.
+     */
+    void setHorizon(int ms)
+    {
+        m_horizon = ms;
+    }
+
+    /**
+     * @brief Weight of the latest velocity in the smoothed one, from 0 to 1.
+     */
+    void setSmoothing(qreal alpha)
+    {
+        m_alpha = qBound<qreal>(0.0, alpha, 1.0);
+    }
+
+    /**
+     * @brief Milliseconds between applied samples.
+     */
+    void setFramePeriod(int ms)
+    {
+        m_period = ms;
+    }
+
+    unsigned long samples() const
+    {
+        return m_samples;
+    }
+
+    unsigned long applied() const
+    {
+        return m_applied;
+    }
+
+    /**
+     * @brief Statistics of the filter, as a JSON object.
+     */
+    std::string json() const;
+
+protected:
+
+    void apply(bool predict);
+
+    /**
+     * @brief A position applied for a time not reached by the input yet.
+     */
+    struct Prediction
+    {
+        qint64 target;
+        QPointF predicted;
+        QPointF raw;
+    };
+
+    void measure(const QPointF& pos, qint64 arrival);
+
+    static const unsigned int MAX_PREDICTIONS = 16;
+
+    ApplyFunction m_apply;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+
+    bool m_coalesce;
+    int m_horizon;
+    qreal m_alpha;
+    int m_period;
+
+    bool m_pending;
+    bool m_hasSample;
+    QPointF m_pos;
+    qint64 m_timestamp;
+    qint64 m_arrival;
+    QPointF m_velocity;
+    qint64 m_lastApply;
+
+    Prediction m_predictions[MAX_PREDICTIONS];
+    unsigned int m_predictionCount;
+
+    unsigned long m_samples;
+    unsigned long m_applied;
+    unsigned long m_measured;
+    double m_predictedError;
+    double m_rawError;
+    double m_predictedMax;
+    double m_rawMax;
+};
+
+#endif // MOTIONFILTER_H
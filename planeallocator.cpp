@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "planeallocator.h"
+#include "graphicsplaneitem.h"
+#include "planemanager.h"
+#include <QDebug>
+#include <QGraphicsScene>
+#include <QTimer>
+#include <QTransform>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Time constant in seconds of the update rate smoothing.
+ */
+static const double RATE_TIME_CONSTANT = 0.5;
+
+/**
+ * @brief Updates per second assumed for an item that does not change.
+ *
+ * Qt still has to blend it whenever something above or below it changes, so bigger static
+ * items are worth more than smaller ones.
+ */
+static const double IDLE_RATE = 1.0;
+
+/**
+ * @brief Extra cost of a scaled or rotated item.
+ */
+static const double TRANSFORM_FACTOR = 2.0;
+
+/**
+ * @brief How much more an item must cost to take the plane of another one.
+ */
+static const double HYSTERESIS = 1.5;
+
+/**
+ * @brief Milliseconds an item keeps a plane, or stays without one, before it can change.
+ */
+static const qint64 MIN_HOLD = 1000;
+
+PlaneAllocator::PlaneAllocator(PlaneManager& planes, QGraphicsScene* scene, int interval)
+    : m_planes(planes),
+      m_scene(scene),
+      m_timer(new QTimer),
+      m_last(0),
+      m_promotions(0),
+      m_demotions(0)
+{
+    if (!scene)
+        qFatal("invalid scene pointer");
+
+    m_clock.start();
+
+    m_timer->setInterval(interval);
+    QObject::connect(m_timer.get(), &QTimer::timeout, [this]() { evaluate(); });
+    m_timer->start();
+}
+
+bool PlaneAllocator::managed(GraphicsPlaneItem* item) const
+{
+    return !item->plane() || m_planes.options(item->plane()).allocate;
+}
+
+bool PlaneAllocator::eligible(GraphicsPlaneItem* item) const
+{
+    if (!item->isVisible())
+        return false;
+
+    // there is no per plane alpha, only the content alpha
+    if (item->effectiveOpacity() < 1.0)
+        return false;
+
+    /*
+     * A plane only scales, rotates by quarter turns and mirrors.  That leaves transforms
+     * that keep rectangles axis aligned.
+     */
+    QTransform t = item->sceneTransform();
+    if (!t.isAffine())
+        return false;
+
+    bool straight = qFuzzyIsNull(t.m12()) && qFuzzyIsNull(t.m21());
+    bool quarter = qFuzzyIsNull(t.m11()) && qFuzzyIsNull(t.m22());
+    if (!straight && !quarter)
+        return false;
+
+    // a plane already held must be able to scale it, others are checked when acquired
+    if (item->plane())
+    {
+        double sx, sy;
+        scale(item, sx, sy);
+        return m_planes.canScale(item->plane(), sx, sy);
+    }
+
+    return true;
+}
+
+void PlaneAllocator::scale(GraphicsPlaneItem* item, double& sx, double& sy)
+{
+    QTransform t = item->sceneTransform();
+    sx = std::hypot(t.m11(), t.m12());
+    sy = std::hypot(t.m21(), t.m22());
+}
+
+double PlaneAllocator::cost(GraphicsPlaneItem* item, const Stats& stats) const
+{
+    if (!item->isVisible() || qFuzzyIsNull(item->effectiveOpacity()))
+        return 0;
+
+    QRectF r = item->sceneBoundingRect() & m_scene->sceneRect();
+    double c = r.width() * r.height() * (stats.rate + IDLE_RATE);
+
+    if (item->sceneTransform().type() > QTransform::TxTranslate)
+        c *= TRANSFORM_FACTOR;
+
+    return c;
+}
+
+bool PlaneAllocator::promote(GraphicsPlaneItem* item, Stats& stats, qint64 now)
+{
+    double sx, sy;
+    scale(item, sx, sy);
+
+    struct plane_data* plane = m_planes.acquirePlane(sx, sy);
+    if (!plane)
+        return false;
+
+    qDebug() << "promote item " << item << " cost " << stats.cost;
+
+    item->setPlane(plane);
+    stats.since = now;
+    m_promotions++;
+
+    return true;
+}
+
+void PlaneAllocator::demote(GraphicsPlaneItem* item, Stats& stats, qint64 now)
+{
+    qDebug() << "demote item " << item << " cost " << stats.cost;
+
+    // setPlane() gives the plane back to the manager
+    item->setPlane(0);
+    stats.since = now;
+    m_demotions++;
+}
+
+void PlaneAllocator::evaluate()
+{
+    qint64 now = m_clock.elapsed();
+    double dt = (now - m_last) / 1000.0;
+    m_last = now;
+    if (dt <= 0)
+        return;
+
+    double keep = std::exp(-dt / RATE_TIME_CONSTANT);
+
+    for (auto& s: m_stats)
+        s.second.seen = false;
+
+    std::vector<GraphicsPlaneItem*> candidates;
+    std::vector<GraphicsPlaneItem*> holders;
+
+    for (auto i: m_scene->items())
+    {
+        GraphicsPlaneItem* item = dynamic_cast<GraphicsPlaneItem*>(i);
+        if (!item || !managed(item))
+            continue;
+
+        auto found = m_stats.find(item);
+        if (found == m_stats.end())
+        {
+            Stats& s = m_stats[item];
+            s.frames = item->frameCount();
+            s.changes = item->changeCount();
+            s.since = now - MIN_HOLD;
+            found = m_stats.find(item);
+        }
+
+        Stats& s = found->second;
+        unsigned long updates = (item->frameCount() - s.frames) + (item->changeCount() - s.changes);
+        s.frames = item->frameCount();
+        s.changes = item->changeCount();
+        s.rate = keep * s.rate + (1.0 - keep) * (updates / dt);
+        s.cost = cost(item, s);
+        s.seen = true;
+
+        if (!eligible(item))
+        {
+            if (item->plane())
+                demote(item, s, now);
+            continue;
+        }
+
+        if (item->plane())
+            holders.push_back(item);
+        else if (s.cost > 0)
+            candidates.push_back(item);
+    }
+
+    // items gone from the scene, deleted items have given back their plane already
+    for (auto i = m_stats.begin(); i != m_stats.end();)
+    {
+        if (!i->second.seen)
+            i = m_stats.erase(i);
+        else
+            ++i;
+    }
+
+    auto costlier = [this](GraphicsPlaneItem* a, GraphicsPlaneItem* b) {
+        return m_stats[a].cost > m_stats[b].cost;
+    };
+
+    std::sort(candidates.begin(), candidates.end(), costlier);
+    std::sort(holders.begin(), holders.end(), costlier);
+
+    for (auto item: candidates)
+    {
+        Stats& s = m_stats[item];
+
+        // no free plane may be able to scale the item, then try to take one
+        if (m_planes.freePlanes() && promote(item, s, now))
+            continue;
+
+        if (holders.empty())
+            break;
+
+        // just lost a plane
+        if (now - s.since < MIN_HOLD)
+            continue;
+
+        // the cheapest holder is the one to give up its plane
+        GraphicsPlaneItem* weakest = holders.back();
+        Stats& w = m_stats[weakest];
+
+        if (s.cost <= w.cost * HYSTERESIS || now - w.since < MIN_HOLD)
+            break;
+
+        double sx, sy;
+        scale(item, sx, sy);
+        if (!m_planes.canScale(weakest->plane(), sx, sy))
+            continue;
+
+        holders.pop_back();
+        demote(weakest, w, now);
+        promote(item, s, now);
+    }
+}
+
+PlaneAllocator::~PlaneAllocator()
+{
+}
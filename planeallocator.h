@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef PLANEALLOCATOR_H
+#define PLANEALLOCATOR_H
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+#include <map>
+#include <memory>
+
+class GraphicsPlaneItem;
+class PlaneManager;
+class QGraphicsScene;
+class QTimer;
+
+/**
+ * @brief The PlaneAllocator class
+ *
+ * Hands the planes of a PlaneManager marked with the "allocate" option out to the
+ * GraphicsPlaneItems of a scene.
+ *
+ * Every item is periodically scored by the cost of compositing it in software: its area,
+ * times how often its content or geometry changes, weighted up for transparency and
+ * transforms.  The most expensive items get a plane, the rest are composited by Qt.  An
+ * item only takes the plane of another one when it costs clearly more, and when the other
+ * one has held the plane for a while, so items don't flip back and forth.
+ *
+ * Items that can't be shown on a plane, because of their opacity or a transform a plane
+ * can't do, are always composited by Qt.  Items created with a plane that is not marked
+ * "allocate" are left alone.
+ */
+class PlaneAllocator
+{
+public:
+
+    /**
+     * @param planes
+     * @param scene
+     * @param interval Milliseconds between evaluations.
+     */
+    PlaneAllocator(PlaneManager& planes, QGraphicsScene* scene, int interval = 100);
+
+    /**
+     * @brief Score the items of the scene and move planes around.
+     */
+    void evaluate();
+
+    /**
+     * @brief Number of times an item got a plane.
+     */
+    unsigned long promotions() const
+    {
+        return m_promotions;
+    }
+
+    /**
+     * @brief Number of times an item lost its plane.
+     */
+    unsigned long demotions() const
+    {
+        return m_demotions;
+    }
+
+    virtual ~PlaneAllocator();
+
+protected:
+
+    struct Stats
+    {
+        Stats()
+            : frames(0), changes(0), rate(0), cost(0), since(0), seen(false)
+        {}
+
+        /**
+         * @brief Counters of the item at the last evaluation.
+         */
+        unsigned long frames;
+        unsigned long changes;
+
+        /**
+         * @brief Smoothed content and geometry updates per second.
+         */
+        double rate;
+
+        double cost;
+
+        /**
+         * @brief When the item last got or lost a plane.
+         */
+        qint64 since;
+
+        bool seen;
+    };
+
+    /**
+     * @brief Cost in pixels per second of compositing an item in software.
+     */
+    double cost(GraphicsPlaneItem* item, const Stats& stats) const;
+
+    /**
+     * @brief Whether a plane can show the item as Qt would.
+     */
+    bool eligible(GraphicsPlaneItem* item) const;
+
+    /**
+     * @brief Whether the allocator may change the plane of the item.
+     */
+    bool managed(GraphicsPlaneItem* item) const;
+
+    /**
+     * @brief Scale factors of the item on screen, that its plane must reach.
+     */
+    static void scale(GraphicsPlaneItem* item, double& sx, double& sy);
+
+    /**
+     * @return false if no free plane can scale the item.
+     */
+    bool promote(GraphicsPlaneItem* item, Stats& stats, qint64 now);
+    void demote(GraphicsPlaneItem* item, Stats& stats, qint64 now);
+
+    PlaneManager& m_planes;
+    QGraphicsScene* m_scene;
+    std::unique_ptr<QTimer> m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_last;
+    std::map<GraphicsPlaneItem*, Stats> m_stats;
+    unsigned long m_promotions;
+    unsigned long m_demotions;
+};
+
+#endif // PLANEALLOCATOR_H
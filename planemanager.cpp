@@ -5,30 +5,69 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "planemanager.h"
+#include "dmabufcache.h"
+#include "framebufferpool.h"
+#include "latencytracker.h"
+#include "swapchain.h"
 #include <planes/engine.h>
 #include <planes/kms.h>
+#include <cjson/cJSON.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <fcntl.h>
 #include <QApplication>
 #include <QDebug>
+#include <QSocketNotifier>
+#include <QTimer>
 #include <qpa/qplatformnativeinterface.h>
 
 /**
  * @brief This requires a custom version of Qt to work with a patch for getting the DRI
  * file descriptor used internally by the linuxfb backend configured in DRM mode.
+ *
+ * With any other platform, such as offscreen, the device named by the
+ * QTVIEWPLANES_DRI_DEVICE environment variable is opened instead, for example vkms.
  */
 static int get_dri_fd()
 {
     static int dri_fd = -1;
     if (dri_fd == -1)
     {
-        void *p = reinterpret_cast<QApplication*>(QApplication::instance())->
-                platformNativeInterface()->nativeResourceForIntegration("dri_fd");
+        QPlatformNativeInterface* native =
+            reinterpret_cast<QApplication*>(QApplication::instance())->platformNativeInterface();
+        void *p = native ? native->nativeResourceForIntegration("dri_fd") : 0;
         if (p)
             dri_fd = (int)(qintptr)p;
     }
+    if (dri_fd == -1)
+    {
+        const char* device = getenv("QTVIEWPLANES_DRI_DEVICE");
+        if (device)
+            dri_fd = open(device, O_RDWR | O_CLOEXEC);
+    }
     return dri_fd;
 }
 
 PlaneManager::PlaneManager()
+    : m_atomic(false),
+      m_flushScheduled(false),
+      m_committedThisFrame(false),
+      m_flipPending(false),
+      m_dirtyFramebuffer(true),
+      m_crtcIndex(-1),
+      m_crtcId(0),
+      m_screenFb(0),
+      m_commitCount(0),
+      m_nextHandlerId(0),
+      m_vblankScheduled(false)
 {
 }
 
@@ -49,9 +88,135 @@ bool PlaneManager::load(const std::string& configfile)
     if (!m_device)
         return false;
 
+    m_atomic = !drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
+    qDebug() << "atomic modesetting " << m_atomic;
+
+    m_crtcIndex = findCrtc();
+    if (m_crtcIndex < 0)
+        return false;
+    m_crtcId = m_device->crtcs[m_crtcIndex]->id;
+
     m_planes.resize(m_device->num_planes, 0);
+    m_pool.reset(new FramebufferPool(m_device.get()));
+    m_dmabufs.reset(new DmaBufCache(m_device.get()));
+
+    if (engine_load_config(configfile.c_str(), m_device.get(), m_planes.data(), m_planes.size(), 0))
+        return false;
+
+    if (!loadOptions(configfile))
+        return false;
+
+    loadCaps();
+
+    // planes left for the allocator stay off until they are acquired
+    for (auto plane: m_planes)
+    {
+        if (plane && options(plane).allocate)
+        {
+            m_free.push_back(plane);
+            state(plane).enabled = false;
+            commit(plane);
+        }
+    }
+
+    m_notifier.reset(new QSocketNotifier(fd, QSocketNotifier::Read));
+    QObject::connect(m_notifier.get(), &QSocketNotifier::activated, [fd]() {
+        drmEventContext ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.version = 2;
+        ctx.vblank_handler = &PlaneManager::vblankHandler;
+        ctx.page_flip_handler = &PlaneManager::pageFlipHandler;
+        drmHandleEvent(fd, &ctx);
+    });
+
+    return true;
+}
+
+bool PlaneManager::loadOptions(const std::string& configfile)
+{
+    std::ifstream in(configfile);
+    if (!in.is_open())
+        return false;
+
+    std::stringstream ss;
+    ss << in.rdbuf();
 
-    return !(engine_load_config(configfile.c_str(), m_device.get(), m_planes.data(), m_planes.size(), 0));
+    cJSON* root = cJSON_Parse(ss.str().c_str());
+    if (!root)
+    {
+        qDebug() << "failed to parse " << configfile.c_str();
+        return false;
+    }
+
+    cJSON* planes = cJSON_GetObjectItem(root, "planes");
+    for (int i = 0; planes && i < cJSON_GetArraySize(planes); i++)
+    {
+        cJSON* p = cJSON_GetArrayItem(planes, i);
+        cJSON* name = cJSON_GetObjectItem(p, "name");
+        if (!name || !name->valuestring)
+            continue;
+
+        PlaneOptions& options = m_options[name->valuestring];
+
+        cJSON* buffers = cJSON_GetObjectItem(p, "buffers");
+        if (buffers)
+        {
+            if (buffers->valueint < 1 || buffers->valueint > 3)
+                qDebug() << "invalid buffer count for plane " << name->valuestring;
+            else
+                options.buffers = buffers->valueint;
+        }
+
+        cJSON* async = cJSON_GetObjectItem(p, "async");
+        if (async)
+            options.async = cJSON_IsTrue(async);
+
+        cJSON* scaleMin = cJSON_GetObjectItem(p, "scale_min");
+        if (scaleMin)
+            options.scaleMin = scaleMin->valuedouble;
+
+        cJSON* scaleMax = cJSON_GetObjectItem(p, "scale_max");
+        if (scaleMax)
+            options.scaleMax = scaleMax->valuedouble;
+
+        cJSON* allocate = cJSON_GetObjectItem(p, "allocate");
+        if (allocate)
+            options.allocate = cJSON_IsTrue(allocate);
+
+        cJSON* background = cJSON_GetObjectItem(p, "background");
+        if (background)
+            options.background = cJSON_IsTrue(background);
+
+        cJSON* hud = cJSON_GetObjectItem(p, "hud");
+        if (hud)
+            options.hud = cJSON_IsTrue(hud);
+
+        cJSON* item = cJSON_GetObjectItem(p, "item");
+        if (item && cJSON_IsObject(item))
+        {
+            auto number = [item](const char* key, double value) {
+                cJSON* v = cJSON_GetObjectItem(item, key);
+                return v && cJSON_IsNumber(v) ? v->valuedouble : value;
+            };
+            auto string = [item](const char* key) {
+                cJSON* v = cJSON_GetObjectItem(item, key);
+                return std::string(v && cJSON_IsString(v) ? v->valuestring : "");
+            };
+
+            options.item.enabled = true;
+            options.item.x = number("x", 0);
+            options.item.y = number("y", 0);
+            options.item.width = std::max(number("width", 0), 0.0);
+            options.item.height = std::max(number("height", 0), 0.0);
+            options.item.z = number("z", 0);
+            options.item.image = string("image");
+            options.item.color = string("color");
+        }
+    }
+
+    cJSON_Delete(root);
+
+    return true;
 }
 
 void PlaneManager::step()
@@ -61,12 +226,7 @@ void PlaneManager::step()
 
 struct plane_data* PlaneManager::get(const std::string& name)
 {
-    for (auto i: m_planes)
-        if (i)
-            if (std::string(i->name) == name)
-                return i;
-
-    return 0;
+    return plane(handle(name));
 }
 
 struct plane_data* PlaneManager::get(unsigned int index)
@@ -77,8 +237,918 @@ struct plane_data* PlaneManager::get(unsigned int index)
     return 0;
 }
 
+void PlaneManager::loadCaps()
+{
+    m_registry.clear();
+    m_byName.clear();
+    m_byPlane.clear();
+    m_byType.assign(PlaneCaps::TypeCount, std::vector<PlaneHandle>());
+    m_byCapability.assign(PlaneCaps::CapabilityCount, std::vector<PlaneHandle>());
+
+    for (auto plane: m_planes)
+    {
+        if (!plane)
+            continue;
+
+        PlaneHandle h = m_registry.size();
+        m_registry.push_back(Entry());
+        Entry& e = m_registry.back();
+        e.plane = plane;
+        e.caps.name = plane->name ? plane->name : "";
+        e.caps.id = plane->plane->id;
+
+        auto o = m_options.find(e.caps.name);
+        if (o != m_options.end())
+            e.options = o->second;
+
+        queryCaps(e);
+
+        m_byName[e.caps.name] = h;
+        m_byPlane[plane] = h;
+        if (e.caps.type < PlaneCaps::TypeCount)
+            m_byType[e.caps.type].push_back(h);
+        for (int c = 0; c < PlaneCaps::CapabilityCount; c++)
+            if (e.caps.has(static_cast<PlaneCaps::Capability>(c)))
+                m_byCapability[c].push_back(h);
+
+        qDebug() << "plane " << e.caps.name.c_str() << " id " << e.caps.id
+                 << " type " << e.caps.type << " formats " << e.caps.formats.size()
+                 << " zpos " << e.caps.zposMin << "-" << e.caps.zposMax
+                 << " rotations " << e.caps.rotations
+                 << " capabilities " << e.caps.capabilities;
+    }
+}
+
+void PlaneManager::queryCaps(Entry& e)
+{
+    PlaneCaps& caps = e.caps;
+    int fd = m_device->fd;
+
+    drmModePlane* p = drmModeGetPlane(fd, caps.id);
+    if (p)
+    {
+        caps.formats.assign(p->formats, p->formats + p->count_formats);
+        drmModeFreePlane(p);
+    }
+
+    drmModeObjectProperties* props = drmModeObjectGetProperties(fd, caps.id, DRM_MODE_OBJECT_PLANE);
+    if (props)
+    {
+        for (uint32_t j = 0; j < props->count_props; j++)
+        {
+            drmModePropertyRes* prop = drmModeGetProperty(fd, props->props[j]);
+            if (!prop)
+                continue;
+
+            std::string name = prop->name;
+            uint64_t value = props->prop_values[j];
+            e.properties[name] = prop->prop_id;
+
+            if (name == "type")
+            {
+                caps.type = static_cast<PlaneCaps::Type>(value);
+            }
+            else if (name == "zpos")
+            {
+                e.props.zpos = prop->prop_id;
+                if ((prop->flags & DRM_MODE_PROP_RANGE) && prop->count_values >= 2)
+                {
+                    caps.zposMin = prop->values[0];
+                    caps.zposMax = prop->values[1];
+                }
+                else
+                {
+                    caps.zposMin = caps.zposMax = value;
+                }
+                caps.zposMutable = !(prop->flags & DRM_MODE_PROP_IMMUTABLE);
+            }
+            else if (name == "rotation")
+            {
+                e.props.rotation = prop->prop_id;
+                // rotation is a bitmask property, each enum value is a bit number
+                for (int k = 0; k < prop->count_enums; k++)
+                    caps.rotations |= 1u << prop->enums[k].value;
+            }
+            else if (name == "alpha")
+            {
+                if (prop->count_values >= 2)
+                    caps.alphaMax = prop->values[1];
+            }
+            else if (name == "pixel blend mode")
+            {
+                for (int k = 0; k < prop->count_enums; k++)
+                {
+                    std::string mode = prop->enums[k].name;
+                    if (mode == "None")
+                        caps.blendModes |= PlaneCaps::BlendNone;
+                    else if (mode == "Pre-multiplied")
+                        caps.blendModes |= PlaneCaps::BlendPremultiplied;
+                    else if (mode == "Coverage")
+                        caps.blendModes |= PlaneCaps::BlendCoverage;
+                }
+            }
+            else if (name == "IN_FORMATS")
+            {
+                drmModePropertyBlobRes* blob = drmModeGetPropertyBlob(fd, value);
+                if (blob)
+                {
+                    const char* data = static_cast<const char*>(blob->data);
+                    auto header = reinterpret_cast<const drm_format_modifier_blob*>(data);
+                    auto formats = reinterpret_cast<const uint32_t*>(data + header->formats_offset);
+                    auto modifiers = reinterpret_cast<const drm_format_modifier*>(data + header->modifiers_offset);
+
+                    // each modifier applies to up to 64 formats starting at its offset
+                    for (uint32_t m = 0; m < header->count_modifiers; m++)
+                        for (uint32_t f = 0; f < 64; f++)
+                            if ((modifiers[m].formats & (1ULL << f)) &&
+                                modifiers[m].offset + f < header->count_formats)
+                                caps.modifiers[formats[modifiers[m].offset + f]].push_back(modifiers[m].modifier);
+
+                    drmModeFreePropertyBlob(blob);
+                }
+            }
+            else if (name == "FB_ID")
+                e.props.fbId = prop->prop_id;
+            else if (name == "CRTC_ID")
+                e.props.crtcId = prop->prop_id;
+            else if (name == "SRC_X")
+                e.props.srcX = prop->prop_id;
+            else if (name == "SRC_Y")
+                e.props.srcY = prop->prop_id;
+            else if (name == "SRC_W")
+                e.props.srcW = prop->prop_id;
+            else if (name == "SRC_H")
+                e.props.srcH = prop->prop_id;
+            else if (name == "CRTC_X")
+                e.props.crtcX = prop->prop_id;
+            else if (name == "CRTC_Y")
+                e.props.crtcY = prop->prop_id;
+            else if (name == "CRTC_W")
+                e.props.crtcW = prop->prop_id;
+            else if (name == "CRTC_H")
+                e.props.crtcH = prop->prop_id;
+
+            drmModeFreeProperty(prop);
+        }
+        drmModeFreeObjectProperties(props);
+    }
+
+    caps.scaleMin = e.options.scaleMin;
+    caps.scaleMax = e.options.scaleMax;
+
+    if (caps.scaleMin != 1.0 || caps.scaleMax != 1.0)
+        caps.capabilities |= 1u << PlaneCaps::Scale;
+    if (caps.rotations & ~(DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y))
+        caps.capabilities |= 1u << PlaneCaps::Rotate;
+    if (caps.rotations & (DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y))
+        caps.capabilities |= 1u << PlaneCaps::Reflect;
+    if (e.props.zpos && caps.zposMutable)
+        caps.capabilities |= 1u << PlaneCaps::Zpos;
+    if (caps.alphaMax)
+        caps.capabilities |= 1u << PlaneCaps::Alpha;
+    if (caps.blendModes & ~PlaneCaps::BlendPremultiplied)
+        caps.capabilities |= 1u << PlaneCaps::Blend;
+    if (!caps.modifiers.empty())
+        caps.capabilities |= 1u << PlaneCaps::Modifiers;
+}
+
+bool PlaneCaps::supports(uint32_t format, uint64_t modifier) const
+{
+    if (modifiers.empty())
+        return modifier == DRM_FORMAT_MOD_LINEAR &&
+            std::find(formats.begin(), formats.end(), format) != formats.end();
+
+    auto i = modifiers.find(format);
+    if (i == modifiers.end())
+        return false;
+
+    return std::find(i->second.begin(), i->second.end(), modifier) != i->second.end();
+}
+
+PlaneManager::PlaneHandle PlaneManager::handle(const std::string& name) const
+{
+    auto i = m_byName.find(name);
+    if (i != m_byName.end())
+        return i->second;
+
+    return -1;
+}
+
+PlaneManager::PlaneHandle PlaneManager::handle(struct plane_data* plane) const
+{
+    auto i = m_byPlane.find(plane);
+    if (i != m_byPlane.end())
+        return i->second;
+
+    return -1;
+}
+
+struct plane_data* PlaneManager::plane(PlaneHandle handle) const
+{
+    if (handle < 0 || handle >= (PlaneHandle)m_registry.size())
+        return 0;
+
+    return m_registry[handle].plane;
+}
+
+const PlaneCaps& PlaneManager::caps(PlaneHandle handle) const
+{
+    static const PlaneCaps none;
+
+    if (handle < 0 || handle >= (PlaneHandle)m_registry.size())
+        return none;
+
+    return m_registry[handle].caps;
+}
+
+const std::vector<PlaneManager::PlaneHandle>& PlaneManager::planesOfType(PlaneCaps::Type type) const
+{
+    static const std::vector<PlaneHandle> none;
+
+    if (type < 0 || type >= (int)m_byType.size())
+        return none;
+
+    return m_byType[type];
+}
+
+const std::vector<PlaneManager::PlaneHandle>& PlaneManager::planesWith(PlaneCaps::Capability capability) const
+{
+    static const std::vector<PlaneHandle> none;
+
+    if (capability < 0 || capability >= (int)m_byCapability.size())
+        return none;
+
+    return m_byCapability[capability];
+}
+
+struct plane_data* PlaneManager::backgroundPlane() const
+{
+    for (auto& e: m_registry)
+        if (e.options.background)
+            return e.plane;
+
+    return 0;
+}
+
+struct plane_data* PlaneManager::hudPlane() const
+{
+    for (auto& e: m_registry)
+        if (e.options.hud)
+            return e.plane;
+
+    return 0;
+}
+
+std::vector<struct plane_data*> PlaneManager::itemPlanes() const
+{
+    std::vector<struct plane_data*> planes;
+    for (auto& e: m_registry)
+        if (e.options.item.enabled)
+            planes.push_back(e.plane);
+
+    return planes;
+}
+
+const PlaneManager::Entry* PlaneManager::entry(struct plane_data* plane) const
+{
+    PlaneHandle h = handle(plane);
+    if (h < 0)
+        return 0;
+
+    return &m_registry[h];
+}
+
+const PlaneOptions& PlaneManager::options(struct plane_data* plane) const
+{
+    static const PlaneOptions defaults;
+
+    const Entry* e = entry(plane);
+    if (e)
+        return e->options;
+
+    return defaults;
+}
+
+SwapChain* PlaneManager::swapchain(struct plane_data* plane)
+{
+    auto i = m_swapchains.find(plane);
+    if (i != m_swapchains.end())
+        return i->second.get();
+
+    SwapChain* chain = new SwapChain(*m_pool, plane, options(plane).buffers);
+    m_swapchains[plane].reset(chain);
+
+    // imported framebuffers are held by the cache while a chain shows them
+    DmaBufCache* dmabufs = m_dmabufs.get();
+    chain->setReleaseHandler([dmabufs](struct kms_framebuffer* fb) {
+        dmabufs->unref(fb);
+    });
+
+    return chain;
+}
+
+PlaneManager::PlaneState& PlaneManager::state(struct plane_data* plane)
+{
+    auto i = m_state.find(plane);
+    if (i != m_state.end())
+        return i->second;
+
+    PlaneState& state = m_state[plane];
+    state.x = plane->x;
+    state.y = plane->y;
+    state.scale_x = plane->scale_x;
+    state.scale_y = plane->scale_y;
+
+    return state;
+}
+
+void PlaneManager::setPos(struct plane_data* plane, int x, int y)
+{
+    PlaneState& s = state(plane);
+    s.x = x;
+    s.y = y;
+
+    plane_set_pos(plane, x, y);
+}
+
+void PlaneManager::setScale(struct plane_data* plane, double scale_x, double scale_y)
+{
+    PlaneState& s = state(plane);
+    s.scale_x = scale_x;
+    s.scale_y = scale_y;
+
+    plane_set_scale_independent(plane, scale_x, scale_y);
+}
+
+void PlaneManager::setZpos(struct plane_data* plane, int zpos)
+{
+    state(plane).zpos = zpos;
+}
+
+void PlaneManager::setStackOrder(struct plane_data* plane, double order)
+{
+    if (!plane)
+        return;
+
+    auto i = m_stack.find(plane);
+    if (i != m_stack.end() && i->second == order)
+        return;
+
+    m_stack[plane] = order;
+    restack();
+}
+
+void PlaneManager::restack()
+{
+    struct Order
+    {
+        double order;
+        int zposMin;
+        uint32_t id;
+        struct plane_data* plane;
+    };
+
+    std::vector<Order> planes;
+    for (auto& i: m_stack)
+    {
+        const PlaneCaps& c = caps(i.first);
+        if (c.zposMutable)
+            planes.push_back({i.second, c.zposMin, c.id, i.first});
+    }
+
+    // equal orders keep the order the driver gives the planes
+    std::sort(planes.begin(), planes.end(), [](const Order& a, const Order& b) {
+        if (a.order != b.order)
+            return a.order < b.order;
+        if (a.zposMin != b.zposMin)
+            return a.zposMin < b.zposMin;
+        return a.id < b.id;
+    });
+
+    int next = std::numeric_limits<int>::min();
+    for (auto& p: planes)
+    {
+        const PlaneCaps& c = caps(p.plane);
+
+        int zpos = std::max(next, c.zposMin);
+        if (zpos > c.zposMax)
+        {
+            qDebug() << "plane " << p.plane->name << " can't go above zpos " << c.zposMax;
+            zpos = c.zposMax;
+        }
+        next = zpos + 1;
+
+        if (state(p.plane).zpos != zpos)
+        {
+            setZpos(p.plane, zpos);
+            commit(p.plane);
+        }
+    }
+}
+
+void PlaneManager::setRotation(struct plane_data* plane, uint32_t rotation)
+{
+    state(plane).rotation = rotation;
+}
+
+bool PlaneManager::canScale(struct plane_data* plane, double scaleX, double scaleY) const
+{
+    if (qFuzzyCompare(scaleX, 1.0) && qFuzzyCompare(scaleY, 1.0))
+        return true;
+
+    const PlaneCaps& c = caps(plane);
+
+    return c.has(PlaneCaps::Scale) &&
+        std::min(scaleX, scaleY) >= c.scaleMin && std::max(scaleX, scaleY) <= c.scaleMax;
+}
+
+struct plane_data* PlaneManager::acquirePlane(double scaleX, double scaleY)
+{
+    auto i = std::find_if(m_free.rbegin(), m_free.rend(), [&](struct plane_data* p) {
+        return canScale(p, scaleX, scaleY);
+    });
+    if (i == m_free.rend())
+        return 0;
+
+    struct plane_data* plane = *i;
+    m_free.erase(std::next(i).base());
+
+    // start over from the config geometry, the previous holder may have moved it anywhere
+    m_state.erase(plane);
+
+    qDebug() << "acquired plane " << plane->name;
+
+    return plane;
+}
+
+unsigned long PlaneManager::poolHits() const
+{
+    return m_pool ? m_pool->hits() : 0;
+}
+
+unsigned long PlaneManager::poolMisses() const
+{
+    return m_pool ? m_pool->misses() : 0;
+}
+
+void PlaneManager::releasePlane(struct plane_data* plane)
+{
+    if (!plane)
+        return;
+
+    m_stack.erase(plane);
+
+    if (!options(plane).allocate)
+        return;
+
+    if (std::find(m_free.begin(), m_free.end(), plane) != m_free.end())
+        return;
+
+    qDebug() << "released plane " << plane->name;
+
+    m_free.push_back(plane);
+    state(plane).enabled = false;
+    commit(plane);
+}
+
+void PlaneManager::commit(struct plane_data* plane)
+{
+    m_dirty.insert(plane);
+
+    if (m_flushScheduled)
+        return;
+
+    m_flushScheduled = true;
+
+    // the page flip event of the commit in progress flushes again
+    if (m_flipPending)
+        return;
+
+    /*
+     * Wait for the end of this event loop iteration to pick up everything else that changes
+     * in it, or for the next vblank if a commit already went out this frame.
+     */
+    if (m_committedThisFrame)
+        scheduleVBlank();
+    else
+        QTimer::singleShot(0, [this]() { flush(); });
+}
+
+void PlaneManager::flush()
+{
+    /*
+     * Still waiting on the page flip or vblank of the last commit, which will flush again.
+     */
+    if (m_flipPending || m_committedThisFrame)
+        return;
+
+    m_flushScheduled = false;
+
+    // a handler may delete an item, and with it a handler that is still to be called
+    auto handlers = m_prepareHandlers;
+    for (auto& i: handlers)
+        if (m_prepareHandlers.count(i.first))
+            i.second();
+
+    if (m_dirty.empty())
+        return;
+
+    /*
+     * Legacy updates are only used when the state can't be expressed as an atomic commit,
+     * not when the device rejects or is still busy with one.
+     */
+    int ret = -ENOTSUP;
+    if (m_atomic)
+        ret = flushAtomic();
+    if (ret == -ENOTSUP)
+        ret = flushLegacy() ? 0 : -EIO;
+
+    if (ret)
+    {
+        // buffers stay queued, and are sent again with the next vblank
+        qWarning() << "plane commit failed: " << ret;
+        m_flushScheduled = true;
+        scheduleVBlank();
+        return;
+    }
+
+    for (auto plane: m_dirty)
+    {
+        auto i = m_swapchains.find(plane);
+        if (i != m_swapchains.end())
+            i->second->committed();
+    }
+
+    m_dirty.clear();
+    m_commitCount++;
+    LatencyTracker::instance().committed(LatencyTracker::Plane);
+
+    // legacy updates have no completion event, they are taken as latched on the next vblank
+    if (!m_flipPending)
+    {
+        m_committedThisFrame = true;
+        scheduleVBlank();
+    }
+}
+
+uint32_t PlaneManager::property(struct plane_data* plane, const char* name) const
+{
+    const Entry* e = entry(plane);
+    if (!e)
+        return 0;
+
+    auto i = e->properties.find(name);
+    if (i != e->properties.end())
+        return i->second;
+
+    return 0;
+}
+
+int PlaneManager::flushAtomic()
+{
+    drmModeAtomicReq* req = drmModeAtomicAlloc();
+    if (!req)
+        return -ENOMEM;
+
+    bool ok = true;
+    bool shown = false;
+    uint32_t object = 0;
+    auto add = [&](uint32_t prop, uint64_t value) {
+        if (!prop || drmModeAtomicAddProperty(req, object, prop, value) < 0)
+            ok = false;
+    };
+
+    for (auto plane: m_dirty)
+    {
+        const Entry* e = entry(plane);
+        if (!e)
+            continue;
+
+        const PlaneProperties& p = e->props;
+        object = e->caps.id;
+
+        PlaneState& s = state(plane);
+        if (!s.enabled)
+        {
+            add(p.fbId, 0);
+            add(p.crtcId, 0);
+            continue;
+        }
+
+        if (!plane->fb)
+            continue;
+
+        struct kms_framebuffer* fb = plane->fb;
+
+        /*
+         * Swap chain buffers come from the pool and have slack, only show the part the
+         * presented buffer was rendered at.  Imported framebuffers are shown whole.
+         */
+        unsigned int width = fb->width;
+        unsigned int height = fb->height;
+        auto chain = m_swapchains.find(plane);
+        if (chain != m_swapchains.end())
+        {
+            width = chain->second->sourceWidth();
+            height = chain->second->sourceHeight();
+        }
+
+        shown = true;
+        add(p.fbId, fb->id);
+        add(p.crtcId, m_crtcId);
+        add(p.srcX, 0);
+        add(p.srcY, 0);
+        add(p.srcW, (uint64_t)width << 16);
+        add(p.srcH, (uint64_t)height << 16);
+        add(p.crtcX, s.x);
+        add(p.crtcY, s.y);
+
+        // a plane rotated by 90 or 270 degrees is as wide on screen as its source is high
+        unsigned int crtcWidth = width;
+        unsigned int crtcHeight = height;
+        if (s.rotation & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270))
+            std::swap(crtcWidth, crtcHeight);
+
+        add(p.crtcW, (uint64_t)(crtcWidth * s.scale_x));
+        add(p.crtcH, (uint64_t)(crtcHeight * s.scale_y));
+        if (s.zpos >= 0)
+            add(p.zpos, s.zpos);
+        // planes without a rotation property only ever show ROTATE_0
+        if (s.rotation && p.rotation)
+            add(p.rotation, s.rotation);
+    }
+
+    if (!ok)
+    {
+        drmModeAtomicFree(req);
+        return -ENOTSUP;
+    }
+
+    /*
+     * Buffers are only retired once the page flip event says the commit is latched.  A
+     * commit that only turns off planes that are already off involves no CRTC, so it gets
+     * no event, and is done blocking instead.
+     */
+    uint32_t flags = shown ? DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT : 0;
+    int ret = drmModeAtomicCommit(m_device->fd, req, flags, this);
+    drmModeAtomicFree(req);
+
+    if (ret)
+        return ret;
+
+    m_flipPending = true;
+    if (!shown)
+        QTimer::singleShot(0, [this]() { flipped(); });
+
+    return 0;
+}
+
+bool PlaneManager::flushLegacy()
+{
+    bool ok = true;
+
+    for (auto plane: m_dirty)
+    {
+        PlaneState& s = state(plane);
+        if (!s.enabled)
+        {
+            if (drmModeSetPlane(m_device->fd, plane->plane->id, 0, 0, 0,
+                                0, 0, 0, 0, 0, 0, 0, 0))
+                ok = false;
+            continue;
+        }
+
+        const Entry* e = entry(plane);
+        if (e && s.zpos >= 0 && e->props.zpos)
+            drmModeObjectSetProperty(m_device->fd, plane->plane->id,
+                                     DRM_MODE_OBJECT_PLANE, e->props.zpos, s.zpos);
+
+        if (e && s.rotation && e->props.rotation)
+            drmModeObjectSetProperty(m_device->fd, plane->plane->id,
+                                     DRM_MODE_OBJECT_PLANE, e->props.rotation, s.rotation);
+
+        if (plane_apply(plane))
+            ok = false;
+    }
+
+    return ok;
+}
+
+int PlaneManager::addPrepareHandler(const std::function<void()>& handler)
+{
+    m_prepareHandlers[m_nextHandlerId] = handler;
+    return m_nextHandlerId++;
+}
+
+void PlaneManager::removePrepareHandler(int id)
+{
+    m_prepareHandlers.erase(id);
+}
+
+int PlaneManager::addVBlankHandler(const std::function<void()>& handler)
+{
+    m_vblankHandlers[m_nextHandlerId] = handler;
+    return m_nextHandlerId++;
+}
+
+void PlaneManager::removeVBlankHandler(int id)
+{
+    m_vblankHandlers.erase(id);
+}
+
+void PlaneManager::scheduleVBlank()
+{
+    if (m_vblankScheduled)
+        return;
+
+    m_vblankScheduled = true;
+
+    drmVBlank vbl;
+    memset(&vbl, 0, sizeof(vbl));
+    unsigned int crtc = m_crtcIndex > 0 ? m_crtcIndex : 0;
+    vbl.request.type = static_cast<drmVBlankSeqType>(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+        ((crtc << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+    vbl.request.sequence = 1;
+    vbl.request.signal = reinterpret_cast<unsigned long>(this);
+
+    if (!m_device || drmWaitVBlank(m_device->fd, &vbl))
+    {
+        /*
+         * No vblank events from this device, so approximate a 60Hz display.
+         */
+        QTimer::singleShot(16, [this]() { vblank(); });
+    }
+}
+
+int PlaneManager::findCrtc() const
+{
+    /*
+     * The platform has already set a mode to show Qt, so the CRTC in use is the one that
+     * scans out a framebuffer.
+     */
+    for (unsigned int i = 0; i < m_device->num_crtcs; i++)
+    {
+        drmModeCrtcPtr crtc = drmModeGetCrtc(m_device->fd, m_device->crtcs[i]->id);
+        if (!crtc)
+            continue;
+
+        bool active = crtc->mode_valid && crtc->buffer_id;
+        drmModeFreeCrtc(crtc);
+
+        if (active)
+        {
+            qDebug() << "using crtc " << m_device->crtcs[i]->id;
+            return i;
+        }
+    }
+
+    if (!m_device->num_crtcs)
+    {
+        qDebug() << "no crtc";
+        return -1;
+    }
+
+    return 0;
+}
+
+uint32_t PlaneManager::screenFramebuffer() const
+{
+    drmModeCrtcPtr crtc = drmModeGetCrtc(m_device->fd, m_crtcId);
+    if (!crtc)
+        return 0;
+
+    uint32_t fb = crtc->buffer_id;
+    drmModeFreeCrtc(crtc);
+
+    return fb;
+}
+
+bool PlaneManager::dirtyFramebuffer(const struct drm_clip_rect* clips, unsigned int count)
+{
+    if (!m_device || !m_dirtyFramebuffer || !count)
+        return false;
+
+    /*
+     * The platforms that need this render into a single framebuffer, so it is only looked
+     * up again if the device no longer knows it.
+     */
+    if (!m_screenFb)
+        m_screenFb = screenFramebuffer();
+    if (!m_screenFb)
+        return false;
+
+    drmModeClipPtr c = const_cast<drmModeClipPtr>(clips);
+    unsigned int n = std::min(count, (unsigned int)DRM_MODE_FB_DIRTY_MAX_CLIPS);
+
+    int ret = drmModeDirtyFB(m_device->fd, m_screenFb, c, n);
+    if (ret == -ENOENT)
+    {
+        m_screenFb = screenFramebuffer();
+        if (!m_screenFb)
+            return false;
+        ret = drmModeDirtyFB(m_device->fd, m_screenFb, c, n);
+    }
+
+    if (ret == -ENOSYS)
+    {
+        qDebug() << "device does not use dirty framebuffers";
+        m_dirtyFramebuffer = false;
+        return false;
+    }
+    else if (ret)
+    {
+        qDebug() << "failed to mark framebuffer dirty: " << ret;
+        return false;
+    }
+
+    return true;
+}
+
+void PlaneManager::vblankHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                 unsigned int tv_usec, void* user_data)
+{
+    Q_UNUSED(fd);
+    Q_UNUSED(sequence);
+    Q_UNUSED(tv_sec);
+    Q_UNUSED(tv_usec);
+
+    static_cast<PlaneManager*>(user_data)->vblank();
+}
+
+void PlaneManager::pageFlipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                   unsigned int tv_usec, void* user_data)
+{
+    Q_UNUSED(fd);
+    Q_UNUSED(sequence);
+    Q_UNUSED(tv_sec);
+    Q_UNUSED(tv_usec);
+
+    static_cast<PlaneManager*>(user_data)->flipped();
+}
+
+void PlaneManager::latched()
+{
+    LatencyTracker::instance().presented(LatencyTracker::Plane);
+
+    for (auto& i: m_swapchains)
+        i.second->vblank();
+
+    if (m_pool)
+        m_pool->vblank();
+}
+
+void PlaneManager::flipped()
+{
+    if (!m_flipPending)
+        return;
+
+    // the atomic commit is on screen now
+    m_flipPending = false;
+    latched();
+
+    if (m_flushScheduled)
+        flush();
+
+    // buffers are free again, items waiting for one may render
+    callVBlankHandlers();
+}
+
+void PlaneManager::vblank()
+{
+    m_vblankScheduled = false;
+
+    // a legacy update sent since the last vblank is taken as on screen now
+    if (m_committedThisFrame)
+    {
+        m_committedThisFrame = false;
+        latched();
+    }
+
+    if (m_flushScheduled)
+        flush();
+
+    callVBlankHandlers();
+}
+
+void PlaneManager::callVBlankHandlers()
+{
+    /*
+     * Handlers may add or remove handlers, or schedule the next vblank.  One that was removed
+     * by an earlier handler is not called, its owner may be gone.
+     */
+    auto handlers = m_vblankHandlers;
+    for (auto& i: handlers)
+        if (m_vblankHandlers.count(i.first))
+            i.second();
+}
+
 PlaneManager::~PlaneManager()
 {
+    m_notifier.reset();
+    m_swapchains.clear();
+    m_dmabufs.reset();
+    m_pool.reset();
+
     for (auto i: m_planes)
         if (i)
             free(i);
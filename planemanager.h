@@ -8,10 +8,241 @@
 #define PLANEMANAGER_H
 
 #include <planes/plane.h>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
 #include <string>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+class DmaBufCache;
+class FramebufferPool;
+class QSocketNotifier;
+class SwapChain;
+struct drm_clip_rect;
+
+/**
+ * @brief A scene item built on a plane at startup, from the "item" object of the plane in the
+ * screen config.
+ */
+struct PlaneItemOptions
+{
+    PlaneItemOptions()
+        : enabled(false),
+          x(0),
+          y(0),
+          width(0),
+          height(0),
+          z(0)
+    {}
+
+    /**
+     * @brief The plane has an "item" object.
+     */
+    bool enabled;
+
+    /**
+     * @brief Initial position, from "x" and "y".
+     */
+    int x;
+    int y;
+
+    /**
+     * @brief Size, from "width" and "height".  0 for the size of the plane.
+     */
+    unsigned int width;
+    unsigned int height;
+
+    /**
+     * @brief Initial stacking order among items, from "z".
+     */
+    double z;
+
+    /**
+     * @brief Image file or resource to show, from "image".
+     */
+    std::string image;
+
+    /**
+     * @brief Color to fill the item with when there is no image, from "color".
+     */
+    std::string color;
+};
+
+/**
+ * @brief Per plane options read from the screen config file.
+ *
+ * These are keys in the plane objects of the config that libplanes itself does not use.
+ */
+struct PlaneOptions
+{
+    PlaneOptions()
+        : buffers(1),
+          async(false),
+          scaleMin(1.0),
+          scaleMax(1.0),
+          allocate(false),
+          background(false),
+          hud(false)
+    {}
+
+    /**
+     * @brief Number of framebuffers in the swap chain of the plane, from "buffers".
+     */
+    unsigned int buffers;
+
+    /**
+     * @brief Render plane content on the RenderWorker thread, from "async".
+     */
+    bool async;
+
+    /**
+     * @brief Range of scale factors the plane scaler supports, from "scale_min" and
+     * "scale_max".  No scaling by default.
+     */
+    double scaleMin;
+    double scaleMax;
+
+    /**
+     * @brief The plane is handed out by acquirePlane() instead of being used by name, from
+     * "allocate".  Such a plane is disabled while nobody holds it.
+     */
+    bool allocate;
+
+    /**
+     * @brief Show the view background on this plane instead of compositing it with Qt, from
+     * "background".  The plane is moved to the bottom if its zpos can be changed, and the
+     * Qt framebuffer must have alpha to show it through.
+     */
+    bool background;
+
+    /**
+     * @brief Show the performance readouts on this plane, from "hud".
+     */
+    bool hud;
+
+    /**
+     * @brief Scene item to build on this plane, from "item".
+     */
+    PlaneItemOptions item;
+};
+
+/**
+ * @brief What a plane can do, queried once from DRM when the PlaneManager is loaded.
+ */
+struct PlaneCaps
+{
+    /**
+     * @brief Plane type, same values as DRM_PLANE_TYPE_*.
+     */
+    enum Type
+    {
+        Overlay = 0,
+        Primary = 1,
+        Cursor = 2,
+        TypeCount
+    };
+
+    /**
+     * @brief Features a plane may have, see has().
+     */
+    enum Capability
+    {
+        Scale,
+        Rotate,
+        Reflect,
+        Zpos,
+        Alpha,
+        Blend,
+        Modifiers,
+        CapabilityCount
+    };
+
+    /**
+     * @brief Pixel blend modes, as flags.
+     */
+    enum BlendMode
+    {
+        BlendNone = 1 << 0,
+        BlendPremultiplied = 1 << 1,
+        BlendCoverage = 1 << 2,
+    };
+
+    PlaneCaps()
+        : id(0),
+          type(Overlay),
+          scaleMin(1.0),
+          scaleMax(1.0),
+          zposMin(0),
+          zposMax(0),
+          zposMutable(false),
+          rotations(0),
+          alphaMax(0),
+          blendModes(0),
+          capabilities(0)
+    {}
+
+    bool has(Capability capability) const
+    {
+        return capabilities & (1u << capability);
+    }
+
+    /**
+     * @brief Whether the plane can scan out a format with a modifier.
+     *
+     * Without an IN_FORMATS property, only linear buffers are assumed to be supported.
+     */
+    bool supports(uint32_t format, uint64_t modifier = 0) const;
+
+    std::string name;
+
+    /**
+     * @brief DRM object id.
+     */
+    uint32_t id;
+
+    Type type;
+
+    std::vector<uint32_t> formats;
+
+    /**
+     * @brief Modifiers by format, from IN_FORMATS.
+     */
+    std::map<uint32_t, std::vector<uint64_t>> modifiers;
+
+    /**
+     * @brief Scaling range.  DRM does not report this, it comes from PlaneOptions.
+     */
+    double scaleMin;
+    double scaleMax;
+
+    int zposMin;
+    int zposMax;
+    bool zposMutable;
+
+    /**
+     * @brief Combination of DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* flags.
+     */
+    uint32_t rotations;
+
+    /**
+     * @brief Maximum value of the alpha property, 0 if there is none.
+     */
+    uint64_t alphaMax;
+
+    /**
+     * @brief Combination of BlendMode flags.
+     */
+    unsigned int blendModes;
+
+    /**
+     * @brief Combination of 1 << Capability.
+     */
+    unsigned int capabilities;
+};
+
 /**
  * @brief The PlaneManager class
  *
@@ -19,11 +250,19 @@
  *
  * When using this class, you can choose to use the built in config and/or the engine provided
  * by libplanes, or chose not to use it.
+ *
+ * Every configured plane gets a handle when the config is loaded.  Handles are indexes that
+ * stay valid for the life of the manager, and all lookups through them are constant time.
  */
 class PlaneManager
 {
 public:
 
+    /**
+     * @brief Stable reference to a configured plane.  -1 is no plane.
+     */
+    typedef int PlaneHandle;
+
     PlaneManager();
 
     /**
@@ -54,10 +293,324 @@ public:
      */
     virtual struct plane_data* get(unsigned int index);
 
+    /**
+     * @brief Get the handle of a plane by name.
+     * @return -1 if there is no such plane.
+     */
+    PlaneHandle handle(const std::string& name) const;
+
+    /**
+     * @brief Get the handle of a plane.
+     * @return -1 if the plane is not configured.
+     */
+    PlaneHandle handle(struct plane_data* plane) const;
+
+    /**
+     * @brief Get a plane by handle.
+     * @return Null for an invalid handle.
+     */
+    struct plane_data* plane(PlaneHandle handle) const;
+
+    /**
+     * @brief Get the capabilities of a plane.
+     * @return Empty capabilities for an invalid handle.
+     */
+    const PlaneCaps& caps(PlaneHandle handle) const;
+
+    const PlaneCaps& caps(struct plane_data* plane) const
+    {
+        return caps(handle(plane));
+    }
+
+    /**
+     * @brief Get the handles of the planes of a type.
+     */
+    const std::vector<PlaneHandle>& planesOfType(PlaneCaps::Type type) const;
+
+    /**
+     * @brief Get the handles of the planes that have a capability.
+     */
+    const std::vector<PlaneHandle>& planesWith(PlaneCaps::Capability capability) const;
+
+    /**
+     * @brief Get the config file options of a plane.
+     * @param plane
+     * @return
+     */
+    const PlaneOptions& options(struct plane_data* plane) const;
+
+    /**
+     * @brief Get the plane with the "background" option.
+     * @return Null if there is none.
+     */
+    struct plane_data* backgroundPlane() const;
+
+    /**
+     * @brief Get the plane with the "hud" option.
+     * @return Null if there is none.
+     */
+    struct plane_data* hudPlane() const;
+
+    /**
+     * @brief Get the planes with an "item" object, in config order.
+     */
+    std::vector<struct plane_data*> itemPlanes() const;
+
+    /**
+     * @brief Get the swap chain of a plane, creating it on first use.
+     * @param plane
+     * @return
+     */
+    SwapChain* swapchain(struct plane_data* plane);
+
+    /**
+     * @brief Get the framebuffer pool shared by all swap chains.
+     * @return
+     */
+    FramebufferPool* pool()
+    {
+        return m_pool.get();
+    }
+
+    /**
+     * @brief Number of pool acquisitions that reused a buffer, 0 without a pool.
+     */
+    unsigned long poolHits() const;
+
+    /**
+     * @brief Number of pool acquisitions that created a buffer, 0 without a pool.
+     */
+    unsigned long poolMisses() const;
+
+    /**
+     * @brief Get the cache of imported dma-buf framebuffers.
+     * @return
+     */
+    DmaBufCache* dmabufs()
+    {
+        return m_dmabufs.get();
+    }
+
+    /**
+     * @brief Set the pending position of a plane.
+     *
+     * Nothing is applied until the next commit().
+     */
+    void setPos(struct plane_data* plane, int x, int y);
+
+    /**
+     * @brief Set the pending scale of a plane.
+     *
+     * Nothing is applied until the next commit().
+     */
+    void setScale(struct plane_data* plane, double scale_x, double scale_y);
+
+    /**
+     * @brief Set the pending zpos of a plane.
+     *
+     * Nothing is applied until the next commit().
+     */
+    void setZpos(struct plane_data* plane, int zpos);
+
+    /**
+     * @brief Set where a plane is stacked relative to the other ordered planes.
+     *
+     * Planes with an order get increasing zpos values in order, within the zpos range of
+     * each plane.  Planes whose zpos can't be changed keep theirs.  Planes that changed are
+     * committed, nothing else about them is touched.
+     *
+     * The order is forgotten when the plane is released.
+     *
+     * @param plane
+     * @param order Any value, lower is further below.
+     */
+    void setStackOrder(struct plane_data* plane, double order);
+
+    /**
+     * @brief Set the pending rotation and reflection of a plane.
+     *
+     * Nothing is applied until the next commit().
+     *
+     * @param plane
+     * @param rotation Combination of DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* flags.
+     */
+    void setRotation(struct plane_data* plane, uint32_t rotation);
+
+    /**
+     * @brief Get the rotation and reflection flags a plane supports.
+     * @return Combination of DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* flags, 0 if the plane
+     * has no rotation property.
+     */
+    uint32_t supportedRotations(struct plane_data* plane) const
+    {
+        return caps(plane).rotations;
+    }
+
+    /**
+     * @brief Whether the scaler of a plane can reach a scale factor.
+     *
+     * Unscaled content fits any plane.
+     */
+    bool canScale(struct plane_data* plane, double scaleX, double scaleY) const;
+
+    /**
+     * @brief Take a free plane of those with the "allocate" option.
+     * @param scaleX Horizontal scale factor the plane must reach, see canScale().
+     * @param scaleY Vertical scale factor the plane must reach.
+     * @return Null if every such plane is taken, or none can scale as needed.
+     */
+    struct plane_data* acquirePlane(double scaleX = 1.0, double scaleY = 1.0);
+
+    /**
+     * @brief Give back a plane taken with acquirePlane().
+     *
+     * The plane is disabled with the next commit.  Nothing is done for other planes.
+     */
+    void releasePlane(struct plane_data* plane);
+
+    /**
+     * @brief Number of planes acquirePlane() can still hand out.
+     */
+    unsigned int freePlanes() const
+    {
+        return m_free.size();
+    }
+
+    /**
+     * @brief Queue the pending state of a plane, including its current framebuffer.
+     *
+     * All planes queued during an event loop iteration are sent to the display controller
+     * together, as a single atomic commit when the device supports it.  At most one commit
+     * is in progress; anything queued meanwhile goes out once it is on screen.  A commit the
+     * device rejects stays queued and is sent again with the next vblank.
+     */
+    void commit(struct plane_data* plane);
+
+    /**
+     * @brief Number of commits sent to the device so far.
+     */
+    unsigned long commitCount() const
+    {
+        return m_commitCount;
+    }
+
+    /**
+     * @brief Register a function to be called right before each commit.
+     *
+     * This is where deferred state gets pushed with setPos(), setScale() and friends, so
+     * that only the latest value of a frame reaches the device.
+     *
+     * @param handler
+     * @return An id to pass to removePrepareHandler().
+     */
+    int addPrepareHandler(const std::function<void()>& handler);
+
+    /**
+     * @brief Remove a handler added with addPrepareHandler().
+     * @param id
+     */
+    void removePrepareHandler(int id);
+
+    /**
+     * @brief Register a function to be called on every vblank event.
+     *
+     * Handlers are only called while vblank events are requested with scheduleVBlank(), and
+     * once an atomic commit is on screen.
+     *
+     * @param handler
+     * @return An id to pass to removeVBlankHandler().
+     */
+    int addVBlankHandler(const std::function<void()>& handler);
+
+    /**
+     * @brief Remove a handler added with addVBlankHandler().
+     * @param id
+     */
+    void removeVBlankHandler(int id);
+
+    /**
+     * @brief Request a call of the vblank handlers on the next vblank.
+     *
+     * Multiple requests before the next vblank result in a single event.
+     */
+    void scheduleVBlank();
+
+    /**
+     * @brief Mark parts of the framebuffer scanned out by the CRTC as changed.
+     *
+     * That is the framebuffer the platform renders Qt into.  Devices that only refresh the
+     * display on request, like command mode panels and virtual devices, then only transfer
+     * these parts.  Devices that scan out continuously don't implement this, in which case
+     * false is returned and further calls do nothing.
+     *
+     * @param clips Rectangles in framebuffer coordinates.
+     * @param count Number of rectangles.
+     */
+    bool dirtyFramebuffer(const struct drm_clip_rect* clips, unsigned int count);
+
     virtual ~PlaneManager();
 
 protected:
 
+    bool loadOptions(const std::string& configfile);
+
+    /**
+     * @brief Find the CRTC the platform shows Qt on.
+     * @return Index of the CRTC, -1 if there is none.
+     */
+    int findCrtc() const;
+
+    /**
+     * @brief Look up the framebuffer the CRTC scans out.
+     * @return Framebuffer id, 0 if there is none.
+     */
+    uint32_t screenFramebuffer() const;
+
+    /**
+     * @brief Build the plane registry from the configured planes.
+     */
+    void loadCaps();
+
+    struct Entry;
+    void queryCaps(Entry& entry);
+
+    struct PlaneState;
+    PlaneState& state(struct plane_data* plane);
+
+    /**
+     * @brief Assign zpos values from the stack order, see setStackOrder().
+     */
+    void restack();
+
+    void flush();
+
+    /**
+     * @brief Send the dirty planes as one atomic commit, completed by a page flip event.
+     * @return 0, -ENOTSUP if the state can't be expressed as an atomic commit, or the
+     * error of the commit.
+     */
+    int flushAtomic();
+
+    /**
+     * @return false if the device rejected the update of a plane.
+     */
+    bool flushLegacy();
+    uint32_t property(struct plane_data* plane, const char* name) const;
+
+    /**
+     * @brief Retire the buffers replaced by the last commit, it is on screen.
+     */
+    void latched();
+
+    void flipped();
+    void vblank();
+    void callVBlankHandlers();
+
+    static void vblankHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                              unsigned int tv_usec, void* user_data);
+    static void pageFlipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                unsigned int tv_usec, void* user_data);
+
     /**
      * @brief The KMS device used to manage planes.
      */
@@ -67,6 +620,142 @@ protected:
      * @brief List of configured planes based on config file.
      */
     std::vector<plane_data*> m_planes;
+
+    /**
+     * @brief Options for each plane, by plane name.
+     */
+    std::map<std::string, PlaneOptions> m_options;
+
+    std::unique_ptr<FramebufferPool> m_pool;
+
+    /**
+     * @brief Framebuffers imported from dma-bufs, shown through swap chains.
+     */
+    std::unique_ptr<DmaBufCache> m_dmabufs;
+
+    /**
+     * @brief Swap chains created by swapchain().
+     */
+    std::map<plane_data*, std::unique_ptr<SwapChain>> m_swapchains;
+
+    /**
+     * @brief State of a plane that is batched into commits.
+     */
+    struct PlaneState
+    {
+        PlaneState()
+            : x(0), y(0), scale_x(1.0), scale_y(1.0), zpos(-1), rotation(0), enabled(true)
+        {}
+
+        int x;
+        int y;
+        double scale_x;
+        double scale_y;
+        int zpos;
+        uint32_t rotation;
+        bool enabled;
+    };
+
+    std::map<plane_data*, PlaneState> m_state;
+    std::set<plane_data*> m_dirty;
+
+    /**
+     * @brief Ids of the plane properties used in commits, 0 for missing ones.
+     */
+    struct PlaneProperties
+    {
+        PlaneProperties()
+            : fbId(0), crtcId(0), srcX(0), srcY(0), srcW(0), srcH(0),
+              crtcX(0), crtcY(0), crtcW(0), crtcH(0), zpos(0), rotation(0)
+        {}
+
+        uint32_t fbId;
+        uint32_t crtcId;
+        uint32_t srcX;
+        uint32_t srcY;
+        uint32_t srcW;
+        uint32_t srcH;
+        uint32_t crtcX;
+        uint32_t crtcY;
+        uint32_t crtcW;
+        uint32_t crtcH;
+        uint32_t zpos;
+        uint32_t rotation;
+    };
+
+    /**
+     * @brief Everything known about a configured plane.
+     */
+    struct Entry
+    {
+        struct plane_data* plane;
+        PlaneCaps caps;
+        PlaneOptions options;
+        PlaneProperties props;
+
+        /**
+         * @brief Ids of all properties by name.
+         */
+        std::map<std::string, uint32_t> properties;
+    };
+
+    const Entry* entry(struct plane_data* plane) const;
+
+    /**
+     * @brief The plane registry, indexed by handle.
+     */
+    std::vector<Entry> m_registry;
+    std::unordered_map<std::string, PlaneHandle> m_byName;
+    std::unordered_map<plane_data*, PlaneHandle> m_byPlane;
+    std::vector<std::vector<PlaneHandle>> m_byType;
+    std::vector<std::vector<PlaneHandle>> m_byCapability;
+
+    /**
+     * @brief Planes with the "allocate" option that are not taken.
+     */
+    std::vector<plane_data*> m_free;
+
+    /**
+     * @brief Stack order of planes, see setStackOrder().
+     */
+    std::map<plane_data*, double> m_stack;
+
+    bool m_atomic;
+    bool m_flushScheduled;
+
+    /**
+     * @brief A legacy update was sent since the last vblank.
+     */
+    bool m_committedThisFrame;
+
+    /**
+     * @brief An atomic commit was sent and its page flip event has not arrived yet.
+     */
+    bool m_flipPending;
+
+    /**
+     * @brief Cleared once the device turns out not to support dirty framebuffers.
+     */
+    bool m_dirtyFramebuffer;
+
+    /**
+     * @brief CRTC all planes are shown on, and vblank events come from, see findCrtc().
+     */
+    int m_crtcIndex;
+    uint32_t m_crtcId;
+
+    /**
+     * @brief Framebuffer of the platform marked dirty by dirtyFramebuffer(), or 0 until it
+     * is looked up.
+     */
+    uint32_t m_screenFb;
+    unsigned long m_commitCount;
+
+    std::map<int, std::function<void()>> m_prepareHandlers;
+    std::map<int, std::function<void()>> m_vblankHandlers;
+    int m_nextHandlerId;
+    bool m_vblankScheduled;
+    std::unique_ptr<QSocketNotifier> m_notifier;
 };
 
 #endif // PLANEMANAGER_H
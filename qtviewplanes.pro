@@ -26,16 +26,42 @@ DEFINES += QT_NO_DEBUG_OUTPUT
 
 
 SOURCES += main.cpp \
+    assetcache.cpp \
+    benchmark.cpp \
+    blit.cpp \
+    cpusampler.cpp \
+    dmabufcache.cpp \
+    framebufferpool.cpp \
     graphicsplaneitem.cpp \
     graphicsplaneview.cpp \
+    huditem.cpp \
+    latencytracker.cpp \
+    motionfilter.cpp \
+    planeallocator.cpp \
     planemanager.cpp \
-    tools.cpp
+    renderworker.cpp \
+    stresstest.cpp \
+    swapchain.cpp \
+    videoitem.cpp
 
 HEADERS  += \
+    assetcache.h \
+    benchmark.h \
+    blit.h \
+    cpusampler.h \
+    dmabufcache.h \
+    framebufferpool.h \
     graphicsplaneitem.h \
     graphicsplaneview.h \
+    huditem.h \
+    latencytracker.h \
+    motionfilter.h \
+    planeallocator.h \
     planemanager.h \
-    tools.h
+    renderworker.h \
+    stresstest.h \
+    swapchain.h \
+    videoitem.h
 
 DISTFILES += \
     qtviewplanes.screen
@@ -64,5 +90,11 @@ PKGCONFIG += libdrm cairo libcjson lua
 
 #CONFIG += LOCALPLANES
 
+# Count heap allocations in benchmark reports with "qmake CONFIG+=count_allocations".  This
+# replaces malloc for the whole process.
+count_allocations {
+    DEFINES += COUNT_ALLOCATIONS
+}
+
 RESOURCES += \
     media.qrc
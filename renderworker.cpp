@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "renderworker.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMutexLocker>
+
+QEvent::Type RenderDoneEvent::type()
+{
+    static QEvent::Type t = static_cast<QEvent::Type>(QEvent::registerEventType());
+    return t;
+}
+
+RenderWorker& RenderWorker::instance()
+{
+    static RenderWorker worker;
+    return worker;
+}
+
+RenderWorker::RenderWorker()
+    : m_running(0),
+      m_quit(false)
+{
+    setObjectName("RenderWorker");
+    start();
+}
+
+void RenderWorker::submit(QObject* receiver, const Job& job, const Job& done)
+{
+    QMutexLocker lock(&m_lock);
+
+    for (auto& t: m_tasks)
+    {
+        if (t.receiver == receiver)
+        {
+            t.job = job;
+            t.done = done;
+            return;
+        }
+    }
+
+    m_tasks.push_back({receiver, job, done});
+    m_wake.wakeOne();
+}
+
+void RenderWorker::cancel(QObject* receiver)
+{
+    QMutexLocker lock(&m_lock);
+
+    for (auto i = m_tasks.begin(); i != m_tasks.end(); ++i)
+    {
+        if (i->receiver == receiver)
+        {
+            m_tasks.erase(i);
+            break;
+        }
+    }
+
+    while (m_running == receiver)
+        m_idle.wait(&m_lock);
+}
+
+void RenderWorker::run()
+{
+    QMutexLocker lock(&m_lock);
+
+    while (!m_quit)
+    {
+        if (m_tasks.empty())
+        {
+            m_wake.wait(&m_lock);
+            continue;
+        }
+
+        Task task = m_tasks.front();
+        m_tasks.pop_front();
+        m_running = task.receiver;
+
+        lock.unlock();
+        task.job();
+        QCoreApplication::postEvent(task.receiver, new RenderDoneEvent(task.done));
+        lock.relock();
+
+        m_running = 0;
+        m_idle.wakeAll();
+    }
+}
+
+RenderWorker::~RenderWorker()
+{
+    {
+        QMutexLocker lock(&m_lock);
+        m_quit = true;
+        m_wake.wakeAll();
+    }
+
+    wait();
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef RENDERWORKER_H
+#define RENDERWORKER_H
+
+#include <QEvent>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+
+/**
+ * @brief Event posted back to the receiver of a job once it is finished.
+ */
+class RenderDoneEvent : public QEvent
+{
+public:
+
+    RenderDoneEvent(const std::function<void()>& done)
+        : QEvent(type()),
+          done(done)
+    {}
+
+    static QEvent::Type type();
+
+    std::function<void()> done;
+};
+
+/**
+ * @brief The RenderWorker class
+ *
+ * A thread that runs render jobs off the GUI thread.  When a job is finished, its done
+ * function is called on the thread of the receiver through a RenderDoneEvent, which the
+ * receiver must handle in QObject::customEvent().
+ *
+ * A receiver has at most one job waiting.  Submitting another one replaces it.
+ */
+class RenderWorker : public QThread
+{
+public:
+
+    typedef std::function<void()> Job;
+
+    /**
+     * @brief The worker shared by the application, started on first use.
+     */
+    static RenderWorker& instance();
+
+    /**
+     * @brief Queue a job.
+     * @param receiver Object that gets the RenderDoneEvent.
+     * @param job Run on the worker thread.
+     * @param done Run on the receiver thread after the job.
+     */
+    void submit(QObject* receiver, const Job& job, const Job& done);
+
+    /**
+     * @brief Drop the waiting job of receiver, and wait for its running job to finish.
+     */
+    void cancel(QObject* receiver);
+
+    virtual ~RenderWorker();
+
+protected:
+
+    RenderWorker();
+
+    virtual void run() override;
+
+    struct Task
+    {
+        QObject* receiver;
+        Job job;
+        Job done;
+    };
+
+    QMutex m_lock;
+    QWaitCondition m_wake;
+    QWaitCondition m_idle;
+    std::deque<Task> m_tasks;
+    QObject* m_running;
+    bool m_quit;
+};
+
+#endif // RENDERWORKER_H
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "stresstest.h"
+#include "cpusampler.h"
+#include "graphicsplaneitem.h"
+#include "planemanager.h"
+#include <cjson/cJSON.h>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QGraphicsObject>
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QParallelAnimationGroup>
+#include <QPropertyAnimation>
+#include <QVariantAnimation>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static const int STEPS = 10;
+static const qreal ITEM_SIZE = 0.1;
+
+StressTest::StressTest(QGraphicsView* view, PlaneManager& planes, int software, int plane,
+                       int interval)
+    : m_view(view),
+      m_planes(planes),
+      m_software(software),
+      m_plane(plane),
+      m_paints(0),
+      m_commits(0),
+      m_poolHits(0),
+      m_poolMisses(0),
+      m_cpu(0)
+{
+    if (!view)
+        qFatal("invalid view pointer");
+
+    m_timer.setInterval(interval);
+    connect(&m_timer, &QTimer::timeout, [this]() { step(); });
+}
+
+void StressTest::start()
+{
+    m_view->viewport()->installEventFilter(this);
+
+    step();
+    m_timer.start();
+}
+
+bool StressTest::eventFilter(QObject* object, QEvent* event)
+{
+    Q_UNUSED(object);
+
+    if (event->type() == QEvent::Paint)
+        m_paints++;
+
+    return false;
+}
+
+void StressTest::add(QGraphicsObject* item, const QRectF& bounding)
+{
+    if (!item)
+        return;
+
+    size_t index = m_softwareItems.size() + m_planeItems.size();
+
+    /*
+     * Spread items over the view the same way on every run, and give each its own period
+     * so they don't all move in step.
+     */
+    qreal w = m_view->width() - bounding.width();
+    qreal h = m_view->height() - bounding.height();
+    QPointF from(std::fmod(index * 0.618034, 1.0) * w, std::fmod(index * 0.381966 + 0.1, 1.0) * h);
+    QPointF to(w - from.x(), h - from.y());
+    int duration = 2000 + (index % 7) * 300;
+
+    item->setPos(from);
+    m_view->scene()->addItem(item);
+
+    QParallelAnimationGroup* group = new QParallelAnimationGroup(this);
+
+    QPropertyAnimation* pos = new QPropertyAnimation(item, "pos", group);
+    pos->setDuration(duration);
+    pos->setStartValue(from);
+    pos->setKeyValueAt(0.5, to);
+    pos->setEndValue(from);
+    pos->setEasingCurve(QEasingCurve::InOutSine);
+    group->addAnimation(pos);
+
+    QPropertyAnimation* scale = new QPropertyAnimation(item, "scale", group);
+    scale->setDuration(duration * 3 / 2);
+    scale->setStartValue(1.0);
+    scale->setKeyValueAt(0.5, 1.5);
+    scale->setEndValue(1.0);
+    group->addAnimation(scale);
+
+    /*
+     * Size is not a property of the items, so it is animated with the base class of
+     * QPropertyAnimation and set through the resize function.
+     */
+    if (m_resize)
+    {
+        QVariantAnimation* size = new QVariantAnimation(group);
+        size->setDuration(duration * 2);
+        size->setStartValue(bounding);
+        size->setKeyValueAt(0.5, QRectF(bounding.topLeft(), bounding.size() * 1.5));
+        size->setEndValue(bounding);
+        ResizeFunction resize = m_resize;
+        connect(size, &QVariantAnimation::valueChanged, [item, resize](const QVariant& value) {
+            resize(item, value.toRectF());
+        });
+        group->addAnimation(size);
+    }
+
+    group->setLoopCount(-1);
+    group->start();
+    m_animations.push_back(group);
+}
+
+void StressTest::step()
+{
+    if (m_clock.isValid())
+        report();
+
+    int softwareStep = (m_software + STEPS - 1) / STEPS;
+    int planeStep = (m_plane + STEPS - 1) / STEPS;
+
+    if ((int)m_softwareItems.size() >= m_software && (int)m_planeItems.size() >= m_plane)
+    {
+        m_timer.stop();
+        QCoreApplication::quit();
+        return;
+    }
+
+    qreal side = std::min(m_view->width(), m_view->height()) * ITEM_SIZE;
+    QRectF bounding(0, 0, side, side);
+
+    for (int i = 0; i < softwareStep && (int)m_softwareItems.size() < m_software; i++)
+    {
+        if (!m_softwareFactory)
+            break;
+        QGraphicsObject* item = m_softwareFactory(bounding);
+        add(item, bounding);
+        m_softwareItems.push_back(item);
+    }
+
+    for (int i = 0; i < planeStep && (int)m_planeItems.size() < m_plane; i++)
+    {
+        if (!m_planeFactory)
+            break;
+        // once all planes are taken, the rest are composited by Qt
+        QGraphicsObject* item = m_planeFactory(m_planes.acquirePlane(), bounding);
+        add(item, bounding);
+        m_planeItems.push_back(item);
+    }
+
+    m_clock.start();
+    m_paints = 0;
+    m_commits = m_planes.commitCount();
+    m_poolHits = m_planes.poolHits();
+    m_poolMisses = m_planes.poolMisses();
+    m_cpu = cpuMs();
+}
+
+void StressTest::report()
+{
+    double seconds = m_clock.elapsed() / 1000.0;
+    if (seconds <= 0)
+        return;
+
+    unsigned long commits = m_planes.commitCount() - m_commits;
+    double cpu = cpuMs() - m_cpu;
+
+    int onPlanes = 0;
+    for (auto item: m_planeItems)
+    {
+        GraphicsPlaneItem* p = dynamic_cast<GraphicsPlaneItem*>(item);
+        if (p && p->plane())
+            onPlanes++;
+    }
+
+    /*
+     * A frame is anything that reached the screen: a repaint of the view composited by
+     * Qt, or a plane commit.
+     */
+    unsigned long frames = m_paints + commits;
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "software_items", m_softwareItems.size());
+    cJSON_AddNumberToObject(root, "plane_items", m_planeItems.size());
+    cJSON_AddNumberToObject(root, "on_planes", onPlanes);
+    cJSON_AddNumberToObject(root, "fps", m_paints / seconds);
+    cJSON_AddNumberToObject(root, "commits_per_second", commits / seconds);
+    cJSON_AddNumberToObject(root, "pool_hits", m_planes.poolHits() - m_poolHits);
+    cJSON_AddNumberToObject(root, "pool_misses", m_planes.poolMisses() - m_poolMisses);
+    cJSON_AddNumberToObject(root, "cpu_ms_per_frame", frames ? cpu / frames : 0);
+    cJSON_AddNumberToObject(root, "cpu_percent", cpu / 10.0 / seconds);
+
+    char* text = cJSON_PrintUnformatted(root);
+    if (text)
+    {
+        fprintf(stdout, "%s\n", text);
+        fflush(stdout);
+        free(text);
+    }
+    cJSON_Delete(root);
+}
+
+StressTest::~StressTest()
+{
+    for (auto animation: m_animations)
+        animation->stop();
+
+    m_view->viewport()->removeEventFilter(this);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef STRESSTEST_H
+#define STRESSTEST_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QRectF>
+#include <QTimer>
+#include <functional>
+#include <vector>
+
+class PlaneManager;
+class QAbstractAnimation;
+class QGraphicsObject;
+class QGraphicsView;
+struct plane_data;
+
+/**
+ * @brief The StressTest class
+ *
+ * Fills the scene of a view with animated items, in steps, to find how many items Qt can
+ * composite and how far planes extend that.
+ *
+ * Each step adds a tenth of the software items and a tenth of the plane items asked for.
+ * Plane items get a plane for as long as there are free ones, the rest start out
+ * composited by Qt.  Every item moves, scales and resizes in a loop.  At the end of each
+ * step one JSON line is printed with the item counts, frames per second, commits per second
+ * and CPU time per frame.  The application quits after the last step.
+ */
+class StressTest : public QObject
+{
+public:
+
+    typedef std::function<QGraphicsObject*(const QRectF& bounding)> SoftwareFactory;
+    typedef std::function<QGraphicsObject*(struct plane_data* plane,
+                                           const QRectF& bounding)> PlaneFactory;
+    typedef std::function<void(QGraphicsObject* item, const QRectF& bounding)> ResizeFunction;
+
+    /**
+     * @param view
+     * @param planes
+     * @param software Number of software items to end up with.
+     * @param plane Number of plane items to end up with.
+     * @param interval Milliseconds each step is measured for.
+     */
+    StressTest(QGraphicsView* view, PlaneManager& planes, int software, int plane,
+               int interval = 3000);
+
+    void setSoftwareFactory(const SoftwareFactory& factory)
+    {
+        m_softwareFactory = factory;
+    }
+
+    void setPlaneFactory(const PlaneFactory& factory)
+    {
+        m_planeFactory = factory;
+    }
+
+    /**
+     * @brief How to change the size of an item, items are not resized without it.
+     */
+    void setResize(const ResizeFunction& resize)
+    {
+        m_resize = resize;
+    }
+
+    void start();
+
+    virtual ~StressTest();
+
+protected:
+
+    virtual bool eventFilter(QObject* object, QEvent* event) override;
+
+    void step();
+    void add(QGraphicsObject* item, const QRectF& bounding);
+    void report();
+
+    QGraphicsView* m_view;
+    PlaneManager& m_planes;
+    int m_software;
+    int m_plane;
+    QTimer m_timer;
+
+    SoftwareFactory m_softwareFactory;
+    PlaneFactory m_planeFactory;
+    ResizeFunction m_resize;
+
+    std::vector<QGraphicsObject*> m_softwareItems;
+    std::vector<QGraphicsObject*> m_planeItems;
+    std::vector<QAbstractAnimation*> m_animations;
+
+    /**
+     * @brief Counters at the start of the current step.
+     */
+    QElapsedTimer m_clock;
+    unsigned long m_paints;
+    unsigned long m_commits;
+    unsigned long m_poolHits;
+    unsigned long m_poolMisses;
+    double m_cpu;
+};
+
+#endif // STRESSTEST_H
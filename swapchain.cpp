@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "swapchain.h"
+#include <QDebug>
+
+SwapChain::SwapChain(FramebufferPool& pool, struct plane_data* plane, unsigned int count)
+    : m_pool(pool),
+      m_plane(plane),
+      m_width(0),
+      m_height(0),
+      m_sourceWidth(plane_width(plane)),
+      m_sourceHeight(plane_height(plane)),
+      m_front(-1),
+      m_queued(-1),
+      m_flight(-1),
+      m_stale(-1),
+      m_frontExternal(0),
+      m_queuedExternal(0),
+      m_flightExternal(0),
+      m_staleExternal(0),
+      m_origFb(plane->fb),
+      m_origBuf(plane->buf)
+{
+    m_buffers.resize(count ? count : 1, {0, 0});
+    if (!allocate(plane_width(plane), plane_height(plane), plane_format(plane)))
+        return;
+
+    /*
+     * The plane now references the first buffer, so treat it as presented.  Any commit of
+     * the plane, even just a move, will scan it out.
+     */
+    m_queued = 0;
+    m_plane->fb = m_buffers[0].fb;
+    m_plane->buf = m_buffers[0].ptr;
+
+    setSource(m_width, m_height);
+}
+
+bool SwapChain::allocate(unsigned int width, unsigned int height, uint32_t format)
+{
+    for (auto& b: m_buffers)
+    {
+        b = m_pool.acquire(width, height, format);
+        if (!b.fb)
+            return false;
+    }
+
+    m_width = width;
+    m_height = height;
+
+    return true;
+}
+
+void SwapChain::setSource(unsigned int width, unsigned int height)
+{
+    m_sourceWidth = width;
+    m_sourceHeight = height;
+
+    plane_set_pan_pos(m_plane, 0, 0);
+    plane_set_pan_size(m_plane, width, height);
+}
+
+void SwapChain::release()
+{
+    for (auto& b: m_buffers)
+    {
+        m_pool.release(b);
+        b = {0, 0};
+    }
+}
+
+void SwapChain::retire()
+{
+    /*
+     * The buffer on screen, any buffer sent to the device, and the buffer the plane points
+     * at may be scanned out until a commit of the new buffers is latched.  Only the others
+     * can go back to the pool now.
+     */
+    for (int i = 0; i < (int)m_buffers.size(); i++)
+    {
+        if (i == m_front || i == m_queued || i == m_flight || i == m_stale)
+            m_retired.push_back(m_buffers[i]);
+        else
+            m_pool.release(m_buffers[i]);
+
+        m_buffers[i] = {0, 0};
+    }
+}
+
+void SwapChain::releaseRetired()
+{
+    for (auto& b: m_retired)
+        m_pool.release(b);
+    m_retired.clear();
+
+    for (auto& fb: m_retiredExternal)
+        drop(fb);
+    m_retiredExternal.clear();
+}
+
+void SwapChain::retireExternal(struct kms_framebuffer*& fb)
+{
+    if (fb)
+        m_retiredExternal.push_back(fb);
+    fb = 0;
+}
+
+void SwapChain::drop(struct kms_framebuffer*& fb)
+{
+    if (fb)
+        m_releases.push_back(fb);
+    fb = 0;
+}
+
+void SwapChain::flushReleases()
+{
+    /*
+     * A release handler may present again, so handlers only run once the state is
+     * consistent, and on a list of their own.
+     */
+    std::vector<struct kms_framebuffer*> released;
+    released.swap(m_releases);
+
+    if (m_releaseHandler)
+        for (auto fb: released)
+            m_releaseHandler(fb);
+}
+
+void SwapChain::dropExternal()
+{
+    drop(m_frontExternal);
+    drop(m_queuedExternal);
+    drop(m_flightExternal);
+    drop(m_staleExternal);
+}
+
+bool SwapChain::owns(struct kms_framebuffer* fb) const
+{
+    for (auto& b: m_buffers)
+        if (b.fb == fb)
+            return true;
+
+    return false;
+}
+
+bool SwapChain::resize(unsigned int width, unsigned int height, uint32_t format)
+{
+    struct kms_framebuffer* fb = m_buffers[0].fb;
+    if (fb &&
+        fb->format == format &&
+        fb->width == FramebufferPool::sizeClass(width) &&
+        fb->height == FramebufferPool::sizeClass(height))
+    {
+        m_width = width;
+        m_height = height;
+
+        /*
+         * What is on screen keeps the size it was rendered at until a buffer of the new
+         * size is presented.  Only a single buffer is drawn on screen.
+         */
+        if (m_buffers.size() == 1 && m_plane->fb == m_buffers[0].fb)
+            setSource(width, height);
+        return true;
+    }
+
+    /*
+     * External framebuffers the plane may show are kept like the old buffers, until a
+     * buffer of the new size is latched.
+     */
+    retire();
+    retireExternal(m_frontExternal);
+    retireExternal(m_queuedExternal);
+    retireExternal(m_flightExternal);
+    retireExternal(m_staleExternal);
+
+    m_front = -1;
+    m_queued = -1;
+    m_flight = -1;
+    m_stale = -1;
+
+    return allocate(width, height, format);
+}
+
+int SwapChain::acquire()
+{
+    if (m_buffers.size() == 1)
+        return 0;
+
+    for (int i = 0; i < (int)m_buffers.size(); i++)
+        if (i != m_front && i != m_queued && i != m_flight && i != m_stale)
+            return i;
+
+    return -1;
+}
+
+bool SwapChain::present(int index)
+{
+    /*
+     * A single buffer is drawn on screen, unless it is new and not committed yet, or an
+     * external framebuffer replaced it.
+     */
+    if (m_buffers.size() == 1 && m_plane->fb == m_buffers[0].fb && m_queued == -1)
+        return false;
+
+    /*
+     * A buffer that was presented but not committed yet never reached the device, so it
+     * is simply replaced.  Latest frame wins.
+     */
+    drop(m_queuedExternal);
+    m_queued = index;
+
+    m_plane->fb = m_buffers[index].fb;
+    m_plane->buf = m_buffers[index].ptr;
+
+    setSource(m_width, m_height);
+
+    flushReleases();
+
+    return true;
+}
+
+bool SwapChain::presentExternal(struct kms_framebuffer* fb)
+{
+    if (!fb)
+        return false;
+
+    drop(m_queuedExternal);
+    m_queued = External;
+    m_queuedExternal = fb;
+
+    m_plane->fb = fb;
+
+    setSource(fb->width, fb->height);
+
+    flushReleases();
+
+    return true;
+}
+
+void SwapChain::committed()
+{
+    if (m_queued == -1)
+        return;
+
+    /*
+     * The buffer already in flight may still be latched by a vblank event that is being
+     * delivered, so hold it back until the next vblank is handled.  An external one held
+     * back before may be the one latched, so it waits for the next vblank as well.
+     */
+    if (m_flight != -1)
+    {
+        retireExternal(m_staleExternal);
+        m_stale = m_flight;
+        m_staleExternal = m_flightExternal;
+    }
+
+    m_flight = m_queued;
+    m_flightExternal = m_queuedExternal;
+    m_queued = -1;
+    m_queuedExternal = 0;
+}
+
+bool SwapChain::vblank()
+{
+    if (m_flight == -1)
+        return false;
+
+    drop(m_frontExternal);
+    drop(m_staleExternal);
+
+    m_front = m_flight;
+    m_frontExternal = m_flightExternal;
+    m_flight = -1;
+    m_flightExternal = 0;
+    m_stale = -1;
+
+    // buffers of the previous size are off screen now
+    releaseRetired();
+
+    flushReleases();
+
+    return true;
+}
+
+SwapChain::~SwapChain()
+{
+    m_plane->fb = m_origFb;
+    m_plane->buf = m_origBuf;
+    release();
+    releaseRetired();
+    dropExternal();
+    flushReleases();
+}
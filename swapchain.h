@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef SWAPCHAIN_H
+#define SWAPCHAIN_H
+
+#include "framebufferpool.h"
+#include <planes/plane.h>
+#include <planes/kms.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief The SwapChain class
+ *
+ * A ring of framebuffers for a single plane.  Content is rendered into a back buffer that
+ * is not being scanned out, and then presented to the plane.  The buffer that was previously
+ * on screen is only handed out again after the next vblank, so drawing never tears against
+ * scanout.
+ *
+ * With a single buffer, the chain degrades to the plain libplanes behavior of drawing
+ * directly into the buffer on screen.
+ *
+ * Buffers come from a FramebufferPool and are usually larger than the size of the chain.
+ * Only the top left width() x height() of a buffer is used, and the plane source rectangle
+ * is set to match.
+ *
+ * External framebuffers, imported from another device, go through the same states as the
+ * buffers of the chain.  The release handler is called once one of them is off screen,
+ * after the chain is done changing state, so it may present again.
+ */
+class SwapChain
+{
+public:
+
+    typedef std::function<void(struct kms_framebuffer* fb)> ReleaseFunction;
+
+    SwapChain(FramebufferPool& pool, struct plane_data* plane, unsigned int count);
+
+    /**
+     * @brief Number of buffers in the chain.
+     */
+    unsigned int count() const
+    {
+        return m_buffers.size();
+    }
+
+    /**
+     * @brief Visible width of the buffers.
+     */
+    unsigned int width() const
+    {
+        return m_width;
+    }
+
+    /**
+     * @brief Visible height of the buffers.
+     */
+    unsigned int height() const
+    {
+        return m_height;
+    }
+
+    /**
+     * @brief Size of what the plane shows, the source rectangle of the last presented
+     * buffer.
+     *
+     * This only differs from width() and height() after a resize(), until a buffer of the
+     * new size is presented.
+     */
+    unsigned int sourceWidth() const
+    {
+        return m_sourceWidth;
+    }
+
+    unsigned int sourceHeight() const
+    {
+        return m_sourceHeight;
+    }
+
+    /**
+     * @brief Resize every buffer in the chain.
+     *
+     * If the current buffers are in the same size class, they are kept and only the source
+     * rectangle of the buffers presented from now on changes.  Otherwise, new buffers are
+     * taken from the pool.
+     *
+     * Either way, the plane keeps showing what it shows at its current size until a buffer
+     * is presented.  Old buffers that may still be scanned out only go back to the pool once
+     * a commit of a new buffer is latched.
+     */
+    bool resize(unsigned int width, unsigned int height, uint32_t format);
+
+    /**
+     * @brief Get a buffer that is safe to render into.
+     * @return Buffer index, or -1 if every buffer is on screen or waiting for vblank.
+     */
+    int acquire();
+
+    /**
+     * @brief Point the plane at a rendered buffer.
+     *
+     * The buffer is not on screen until the plane is committed.
+     *
+     * @return true if the plane needs to be committed to show the buffer.
+     */
+    bool present(int index);
+
+    /**
+     * @brief Point the plane at a framebuffer that is not part of the chain.
+     *
+     * The whole framebuffer is shown.  The caller keeps it alive until the release handler
+     * is called for it.
+     *
+     * @return true if the plane needs to be committed to show the framebuffer.
+     */
+    bool presentExternal(struct kms_framebuffer* fb);
+
+    /**
+     * @brief Set the function called when an external framebuffer is no longer used.
+     */
+    void setReleaseHandler(const ReleaseFunction& handler)
+    {
+        m_releaseHandler = handler;
+    }
+
+    /**
+     * @brief Is the framebuffer one of the buffers of the chain?
+     */
+    bool owns(struct kms_framebuffer* fb) const;
+
+    /**
+     * @brief The presented buffer was sent to the device.
+     */
+    void committed();
+
+    /**
+     * @brief Retire buffers after a vblank.
+     * @return true if a buffer was released.
+     */
+    bool vblank();
+
+    /**
+     * @brief Is a presented buffer still waiting for a commit or vblank?
+     */
+    bool pending() const
+    {
+        return m_queued != -1 || m_flight != -1;
+    }
+
+    void* buffer(int index) const
+    {
+        return m_buffers[index].ptr;
+    }
+
+    struct kms_framebuffer* framebuffer(int index) const
+    {
+        return m_buffers[index].fb;
+    }
+
+    /**
+     * @brief Bytes per line of the buffers.
+     */
+    unsigned int pitch() const
+    {
+        return m_buffers[0].fb->pitch;
+    }
+
+    virtual ~SwapChain();
+
+protected:
+
+    /**
+     * @brief Index of the state slots holding an external framebuffer.
+     */
+    static const int External = -2;
+
+    bool allocate(unsigned int width, unsigned int height, uint32_t format);
+    void setSource(unsigned int width, unsigned int height);
+    void release();
+    void retire();
+    void releaseRetired();
+    void retireExternal(struct kms_framebuffer*& fb);
+
+    /**
+     * @brief Queue the release of an external framebuffer, see flushReleases().
+     */
+    void drop(struct kms_framebuffer*& fb);
+    void dropExternal();
+
+    /**
+     * @brief Call the release handler for the framebuffers dropped so far.
+     */
+    void flushReleases();
+
+    FramebufferPool& m_pool;
+    struct plane_data* m_plane;
+    std::vector<FramebufferPool::Buffer> m_buffers;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_sourceWidth;
+    unsigned int m_sourceHeight;
+
+    /**
+     * @brief Buffer currently scanned out, or referenced by the plane.
+     */
+    int m_front;
+
+    /**
+     * @brief Buffer presented but not yet committed, or -1.
+     */
+    int m_queued;
+
+    /**
+     * @brief Buffer committed but not yet latched by a vblank, or -1.
+     */
+    int m_flight;
+
+    /**
+     * @brief Buffer replaced while in flight, held back until the next vblank, or -1.
+     */
+    int m_stale;
+
+    /**
+     * @brief Buffers replaced by resize() that may still be scanned out.
+     */
+    std::vector<FramebufferPool::Buffer> m_retired;
+    std::vector<struct kms_framebuffer*> m_retiredExternal;
+
+    /**
+     * @brief External framebuffers off screen, waiting for the release handler.
+     */
+    std::vector<struct kms_framebuffer*> m_releases;
+
+    /**
+     * @brief External framebuffers in each state, when the index of the state is External.
+     */
+    struct kms_framebuffer* m_frontExternal;
+    struct kms_framebuffer* m_queuedExternal;
+    struct kms_framebuffer* m_flightExternal;
+    struct kms_framebuffer* m_staleExternal;
+
+    ReleaseFunction m_releaseHandler;
+
+    /**
+     * @brief The framebuffer libplanes allocated, restored on destruction.
+     */
+    struct kms_framebuffer* m_origFb;
+    void* m_origBuf;
+};
+
+#endif // SWAPCHAIN_H
@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Checks every SIMD kernel of blit.cpp against the scalar version.
+#
+# Run with: qmake && make check
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+QT       -= widgets
+
+TARGET = tst_blit
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_blit.cpp \
+    ../../blit.cpp
+
+HEADERS += \
+    ../../blit.h
+
+CONFIG += link_pkgconfig
+PKGCONFIG += libdrm
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "blit.h"
+#include <QtTest>
+#include <drm_fourcc.h>
+#include <random>
+#include <vector>
+
+/**
+ * @brief The TestBlit class
+ *
+ * Runs the kernels of the best instruction set of the running CPU on random pixels and
+ * compares them byte for byte with the scalar kernels.  Widths and heights go through every
+ * vector tail and odd size, and the bytes around the block must stay untouched.  Mirror and
+ * rotation are checked against a plain copy.  Converting damage with odd edges must give the
+ * same result as converting the whole image.
+ */
+class TestBlit : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void initTestCase();
+    void kernel_data();
+    void kernel();
+    void damage_data();
+    void damage();
+    void mirror_data();
+    void mirror();
+    void rotate_data();
+    void rotate();
+
+private:
+
+    std::vector<uchar> random(size_t size);
+    QImage image(int width, int height);
+
+    std::mt19937 m_random;
+};
+
+void TestBlit::initTestCase()
+{
+    m_random.seed(0x51565041);
+    qDebug() << "isa" << Blit::bestIsa();
+}
+
+std::vector<uchar> TestBlit::random(size_t size)
+{
+    std::vector<uchar> data(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = m_random() & 0xff;
+    return data;
+}
+
+QImage TestBlit::image(int width, int height)
+{
+    QImage result(width, height, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < height; y++)
+    {
+        QRgb* line = reinterpret_cast<QRgb*>(result.scanLine(y));
+        for (int x = 0; x < width; x++)
+            line[x] = m_random() | 0xff000000;
+    }
+    return result;
+}
+
+void TestBlit::kernel_data()
+{
+    QTest::addColumn<uint>("format");
+
+    QTest::newRow("ARGB8888") << (uint)DRM_FORMAT_ARGB8888;
+    QTest::newRow("XRGB8888") << (uint)DRM_FORMAT_XRGB8888;
+    QTest::newRow("RGB565") << (uint)DRM_FORMAT_RGB565;
+    QTest::newRow("ARGB4444") << (uint)DRM_FORMAT_ARGB4444;
+    QTest::newRow("NV12") << (uint)DRM_FORMAT_NV12;
+    QTest::newRow("YUYV") << (uint)DRM_FORMAT_YUYV;
+}
+
+void TestBlit::kernel()
+{
+    QFETCH(uint, format);
+
+    Blit::Kernel simd = Blit::kernel(format, Blit::bestIsa());
+    Blit::Kernel scalar = Blit::kernel(format, Blit::Scalar);
+    QVERIFY(simd);
+    QVERIFY(scalar);
+
+    for (int height = 1; height <= 5; height++)
+    {
+        for (int width = 1; width <= 67; width++)
+        {
+            // odd pitches, and a margin to catch writes past the block
+            int srcPitch = width * 4 + 12;
+            int pitch = width * 4 + 20;
+            std::vector<uchar> src = random(srcPitch * height);
+            std::vector<uchar> expected = random(pitch * (height + (height + 1) / 2 + 1));
+            std::vector<uchar> actual = expected;
+
+            scalar(src.data(), srcPitch, expected.data(), pitch,
+                   expected.data() + pitch * height, pitch, width, height);
+            simd(src.data(), srcPitch, actual.data(), pitch,
+                 actual.data() + pitch * height, pitch, width, height);
+
+            if (expected != actual)
+                QFAIL(qPrintable(QString("mismatch at %1x%2").arg(width).arg(height)));
+        }
+    }
+}
+
+void TestBlit::damage_data()
+{
+    QTest::addColumn<uint>("format");
+    QTest::addColumn<QRect>("rect");
+
+    QTest::newRow("NV12 odd offset") << (uint)DRM_FORMAT_NV12 << QRect(3, 3, 5, 5);
+    QTest::newRow("NV12 odd size") << (uint)DRM_FORMAT_NV12 << QRect(2, 4, 3, 3);
+    QTest::newRow("NV12 pixel") << (uint)DRM_FORMAT_NV12 << QRect(5, 7, 1, 1);
+    QTest::newRow("NV12 image edge") << (uint)DRM_FORMAT_NV12 << QRect(13, 9, 2, 2);
+    QTest::newRow("YUYV odd offset") << (uint)DRM_FORMAT_YUYV << QRect(3, 3, 5, 5);
+    QTest::newRow("YUYV odd size") << (uint)DRM_FORMAT_YUYV << QRect(2, 4, 3, 3);
+    QTest::newRow("YUYV pixel") << (uint)DRM_FORMAT_YUYV << QRect(5, 7, 1, 1);
+    QTest::newRow("YUYV image edge") << (uint)DRM_FORMAT_YUYV << QRect(13, 9, 2, 2);
+}
+
+void TestBlit::damage()
+{
+    QFETCH(uint, format);
+    QFETCH(QRect, rect);
+
+    // odd on purpose, so the last chroma samples only have one pixel
+    static const int WIDTH = 15;
+    static const int HEIGHT = 11;
+
+    int pitch = WIDTH * 4;
+    size_t size = pitch * (HEIGHT + (HEIGHT + 1) / 2);
+
+    QImage before = image(WIDTH, HEIGHT);
+    QImage after = before.copy();
+    QImage changed = image(WIDTH, HEIGHT);
+    for (int y = rect.top(); y <= rect.bottom(); y++)
+        memcpy(after.scanLine(y) + rect.left() * 4, changed.constScanLine(y) + rect.left() * 4,
+               rect.width() * 4);
+
+    std::vector<uchar> expected(size);
+    std::vector<uchar> actual(size);
+
+    QVERIFY(Blit::convert(format, after, after.rect(), expected.data(), pitch, HEIGHT));
+    QVERIFY(Blit::convert(format, before, before.rect(), actual.data(), pitch, HEIGHT));
+    QVERIFY(Blit::convert(format, after, rect, actual.data(), pitch, HEIGHT));
+
+    QVERIFY(expected == actual);
+}
+
+void TestBlit::mirror_data()
+{
+    QTest::addColumn<int>("bpp");
+    QTest::addColumn<bool>("horizontal");
+    QTest::addColumn<bool>("vertical");
+
+    QTest::newRow("32 horizontal") << 4 << true << false;
+    QTest::newRow("32 vertical") << 4 << false << true;
+    QTest::newRow("32 both") << 4 << true << true;
+    QTest::newRow("16 horizontal") << 2 << true << false;
+    QTest::newRow("16 vertical") << 2 << false << true;
+    QTest::newRow("16 both") << 2 << true << true;
+}
+
+void TestBlit::mirror()
+{
+    QFETCH(int, bpp);
+    QFETCH(bool, horizontal);
+    QFETCH(bool, vertical);
+
+    for (int height = 1; height <= 5; height++)
+    {
+        for (int width = 1; width <= 35; width++)
+        {
+            int pitch = width * bpp + 6;
+            std::vector<uchar> src = random(pitch * height);
+            std::vector<uchar> expected = src;
+
+            for (int y = 0; y < height; y++)
+            {
+                int sy = vertical ? height - 1 - y : y;
+                for (int x = 0; x < width; x++)
+                {
+                    int sx = horizontal ? width - 1 - x : x;
+                    memcpy(&expected[y * pitch + x * bpp], &src[sy * pitch + sx * bpp], bpp);
+                }
+            }
+
+            QVERIFY(Blit::mirror(src.data(), pitch, bpp, width, height, horizontal, vertical));
+
+            if (expected != src)
+                QFAIL(qPrintable(QString("mismatch at %1x%2").arg(width).arg(height)));
+        }
+    }
+}
+
+void TestBlit::rotate_data()
+{
+    QTest::addColumn<bool>("clockwise");
+
+    QTest::newRow("clockwise") << true;
+    QTest::newRow("counter-clockwise") << false;
+}
+
+void TestBlit::rotate()
+{
+    QFETCH(bool, clockwise);
+
+    for (int height = 1; height <= 37; height++)
+    {
+        for (int width = 1; width <= 37; width++)
+        {
+            int srcPitch = width * 4 + 8;
+            int pitch = height * 4 + 12;
+            std::vector<uchar> src = random(srcPitch * height);
+            std::vector<uchar> expected = random(pitch * width);
+            std::vector<uchar> actual = expected;
+
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    int dx = clockwise ? height - 1 - y : y;
+                    int dy = clockwise ? x : width - 1 - x;
+                    memcpy(&expected[dy * pitch + dx * 4], &src[y * srcPitch + x * 4], 4);
+                }
+            }
+
+            Blit::rotate(src.data(), srcPitch, actual.data(), pitch, width, height, clockwise);
+
+            if (expected != actual)
+                QFAIL(qPrintable(QString("mismatch at %1x%2").arg(width).arg(height)));
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(TestBlit)
+
+#include "tst_blit.moc"
@@ -0,0 +1,533 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "videoitem.h"
+#include "blit.h"
+#include "swapchain.h"
+#include <cjson/cJSON.h>
+#include <drm_fourcc.h>
+#include <algorithm>
+#include <cstdlib>
+#include <QDebug>
+#include <QDir>
+#include <QGuiApplication>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QScreen>
+
+/**
+ * @brief Bytes per line of a raw frame, or 0 if the format is not supported.
+ */
+static int rawPitch(uint32_t format, int width)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_NV12:
+        return width;
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_ARGB4444:
+        return width * 2;
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+        return width * 4;
+    }
+
+    return 0;
+}
+
+VideoDecoder::VideoDecoder(unsigned int capacity)
+    : m_capacity(std::max(capacity, 1u)),
+      m_count(0),
+      m_format(0),
+      m_imageFormat(QImage::Format_ARGB32_Premultiplied),
+      m_passthrough(false),
+      m_period(0),
+      m_overflows(0),
+      m_quit(false)
+{
+    setObjectName("VideoDecoder");
+}
+
+bool VideoDecoder::openSequence(const QString& path, QImage::Format format)
+{
+    QStringList filters;
+    for (auto& f: QImageReader::supportedImageFormats())
+        filters << "*." + QString::fromLatin1(f);
+
+    QDir dir(path);
+    m_files.clear();
+    for (auto& name: dir.entryList(filters, QDir::Files, QDir::Name))
+        m_files << dir.filePath(name);
+
+    if (m_files.isEmpty())
+        return false;
+
+    // every frame is delivered at the size of the first one
+    m_size = QImageReader(m_files.first()).size();
+    if (m_size.isEmpty())
+        return false;
+
+    m_file.close();
+    m_count = m_files.size();
+    m_format = 0;
+    m_imageFormat = format;
+    m_passthrough = false;
+
+    return true;
+}
+
+bool VideoDecoder::openRaw(const QString& path, const QSize& size, uint32_t format,
+                           QImage::Format image, bool passthrough)
+{
+    int pitch = rawPitch(format, size.width());
+    if (!pitch || size.isEmpty())
+    {
+        qDebug() << "unsupported raw video format " << format;
+        return false;
+    }
+
+    if (!passthrough && Blit::imageFormat(format) == QImage::Format_Invalid)
+    {
+        qDebug() << "raw video format " << format << " must match the plane format";
+        return false;
+    }
+
+    m_file.close();
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 bytes = (qint64)pitch * size.height();
+    if (format == DRM_FORMAT_NV12)
+        bytes += bytes / 2;
+
+    m_count = m_file.size() / bytes;
+    if (!m_count)
+        return false;
+
+    m_files.clear();
+    m_size = size;
+    m_format = format;
+    m_imageFormat = image;
+    m_passthrough = passthrough;
+
+    return true;
+}
+
+void VideoDecoder::play(double fps)
+{
+    stop();
+
+    m_period = 1000000000LL / (fps > 0 ? fps : 30);
+    m_overflows = 0;
+    m_clock.start();
+
+    start();
+}
+
+void VideoDecoder::stop()
+{
+    {
+        QMutexLocker lock(&m_lock);
+        m_quit = true;
+        m_wake.wakeAll();
+    }
+
+    wait();
+
+    QMutexLocker lock(&m_lock);
+    m_quit = false;
+    m_ring.clear();
+}
+
+bool VideoDecoder::take(VideoFrame& frame, unsigned long& skipped)
+{
+    QMutexLocker lock(&m_lock);
+
+    qint64 t = now();
+    bool found = false;
+    skipped = 0;
+
+    while (!m_ring.empty() && m_ring.front().pts <= t)
+    {
+        if (found)
+            skipped++;
+
+        frame = m_ring.front();
+        m_ring.pop_front();
+        found = true;
+    }
+
+    if (found)
+        m_wake.wakeOne();
+
+    return found;
+}
+
+unsigned long VideoDecoder::overflows()
+{
+    QMutexLocker lock(&m_lock);
+    return m_overflows;
+}
+
+bool VideoDecoder::decode(unsigned long index, VideoFrame& frame)
+{
+    if (!m_files.isEmpty())
+    {
+        QImageReader reader(m_files[index]);
+        if (reader.size() != m_size)
+            reader.setScaledSize(m_size);
+
+        QImage image = reader.read();
+        if (image.isNull())
+            return false;
+
+        frame.image = image.convertToFormat(m_imageFormat);
+        return true;
+    }
+
+    int pitch = rawPitch(m_format, m_size.width());
+    qint64 bytes = (qint64)pitch * m_size.height();
+    if (m_format == DRM_FORMAT_NV12)
+        bytes += bytes / 2;
+
+    if (!m_file.seek(index * bytes))
+        return false;
+
+    QByteArray data = m_file.read(bytes);
+    if (data.size() != bytes)
+        return false;
+
+    if (m_passthrough)
+    {
+        frame.raw = data;
+        frame.pitch = pitch;
+        return true;
+    }
+
+    // the wrapper doesn't own the data, so never keep it
+    QImage wrapper(reinterpret_cast<const uchar*>(data.constData()),
+                   m_size.width(), m_size.height(), pitch, Blit::imageFormat(m_format));
+    if (wrapper.format() == m_imageFormat)
+        frame.image = wrapper.copy();
+    else
+        frame.image = wrapper.convertToFormat(m_imageFormat);
+
+    return true;
+}
+
+void VideoDecoder::run()
+{
+    unsigned long n = 0;
+
+    QMutexLocker lock(&m_lock);
+
+    while (!m_quit)
+    {
+        qint64 pts = n * m_period;
+        qint64 t = now();
+
+        // a frame already a whole period late is not worth decoding
+        if (t - pts > m_period)
+        {
+            unsigned long current = t / m_period;
+            m_overflows += current - n;
+            n = current;
+            continue;
+        }
+
+        // don't decode further ahead than the ring holds
+        qint64 ahead = pts - (qint64)(m_capacity - 1) * m_period - t;
+        if (ahead > 0)
+        {
+            m_wake.wait(&m_lock, ahead / 1000000 + 1);
+            continue;
+        }
+
+        lock.unlock();
+
+        VideoFrame frame;
+        bool ok = decode(n % m_count, frame);
+        frame.pts = pts;
+        frame.decoded = now();
+        frame.decodeTime = frame.decoded - t;
+
+        lock.relock();
+
+        n++;
+
+        if (!ok)
+            continue;
+
+        m_ring.push_back(frame);
+        if (m_ring.size() > m_capacity)
+        {
+            m_ring.pop_front();
+            m_overflows++;
+        }
+    }
+}
+
+VideoDecoder::~VideoDecoder()
+{
+    stop();
+}
+
+VideoItem::VideoItem(PlaneManager& planes, struct plane_data* plane, unsigned int ring)
+    : GraphicsPlaneItem(planes, plane, QRectF(0, 0, 1, 1)),
+      m_decoder(ring),
+      m_fps(0),
+      m_rawFormat(0),
+      m_playing(false),
+      m_holding(false),
+      m_presentedAt(-1),
+      m_shown(0),
+      m_late(0),
+      m_stalls(0),
+      m_decodeTotal(0),
+      m_decodeMax(0),
+      m_queueTotal(0),
+      m_queueMax(0),
+      m_displayTotal(0),
+      m_displayMax(0),
+      m_displayed(0)
+{
+    setAcceptedMouseButtons(Qt::NoButton);
+
+    m_vblankId = m_planes.addVBlankHandler([this]() { tick(); });
+    connect(&m_timer, &QTimer::timeout, this, [this]() { tick(); });
+}
+
+bool VideoItem::play(const QString& path, double fps, const QSize& rawSize, uint32_t rawFormat)
+{
+    stop();
+
+    m_path = path;
+    m_fps = fps;
+    m_rawSize = rawSize;
+    m_rawFormat = rawFormat;
+
+    if (!open())
+        return false;
+
+    QSize size = m_decoder.size();
+    prepareGeometryChange();
+    m_bounding = QRectF(QPointF(0, 0), size);
+    if (!resizeBuffers(size.width(), size.height()))
+    {
+        stop();
+        return false;
+    }
+    moveEvent(pos());
+
+    m_shown = m_late = m_stalls = m_displayed = 0;
+    m_decodeTotal = m_decodeMax = 0;
+    m_queueTotal = m_queueMax = 0;
+    m_displayTotal = m_displayMax = 0;
+
+    pace();
+
+    return true;
+}
+
+bool VideoItem::open()
+{
+    /*
+     * Frames are delivered in the format the back buffer is painted in, so showing them is
+     * a plain copy.  Raw frames already in the plane format are not converted at all.
+     */
+    QImage::Format image = QImage::Format_ARGB32_Premultiplied;
+    bool passthrough = false;
+    if (m_plane)
+    {
+        uint32_t format = plane_format(m_plane);
+        if (Blit::imageFormat(format) != QImage::Format_Invalid)
+            image = Blit::imageFormat(format);
+        passthrough = m_rawFormat == format;
+    }
+
+    bool ok;
+    if (m_rawSize.isValid())
+        ok = m_decoder.openRaw(m_path, m_rawSize, m_rawFormat, image, passthrough);
+    else
+        ok = m_decoder.openSequence(m_path, image);
+
+    if (!ok)
+    {
+        qDebug() << "can't play " << m_path;
+        return false;
+    }
+
+    m_playing = true;
+    m_decoder.play(m_fps);
+
+    return true;
+}
+
+void VideoItem::pace()
+{
+    if (m_plane)
+    {
+        m_timer.stop();
+        m_planes.scheduleVBlank();
+    }
+    else
+    {
+        qreal rate = QGuiApplication::primaryScreen()->refreshRate();
+        m_timer.start(rate > 0 ? qRound(1000.0 / rate) : 16);
+    }
+}
+
+void VideoItem::planeChanged()
+{
+    if (!m_playing)
+        return;
+
+    /*
+     * Frames already decoded are in the format of the old target, and the last one
+     * presented went to its swap chain.  The stream starts over in the new format, the
+     * counters carry on.
+     */
+    stop();
+    if (!open())
+        return;
+
+    pace();
+}
+
+void VideoItem::stop()
+{
+    m_playing = false;
+    m_timer.stop();
+    m_decoder.stop();
+    m_holding = false;
+    m_held = VideoFrame();
+    m_presentedAt = -1;
+}
+
+void VideoItem::redraw()
+{
+    // a buffer is free again
+    tick();
+}
+
+void VideoItem::tick()
+{
+    if (!m_playing)
+        return;
+
+    qint64 now = m_decoder.now();
+
+    // the last frame is on screen once its commit is latched by a vblank
+    if (m_presentedAt >= 0 && (!m_plane || !m_planes.swapchain(m_plane)->pending()))
+    {
+        qint64 t = now - m_presentedAt;
+        m_displayTotal += t;
+        m_displayMax = std::max(m_displayMax, t);
+        m_displayed++;
+        m_presentedAt = -1;
+    }
+
+    if (m_plane)
+        m_planes.scheduleVBlank();
+
+    VideoFrame frame;
+    unsigned long skipped;
+    if (m_decoder.take(frame, skipped))
+    {
+        // a held frame that never got a buffer is overtaken too
+        m_late += skipped + (m_holding ? 1 : 0);
+        m_held = frame;
+        m_holding = true;
+    }
+
+    if (!m_holding)
+        return;
+
+    if (show(m_held))
+    {
+        m_held = VideoFrame();
+        m_holding = false;
+    }
+    else
+    {
+        m_stalls++;
+    }
+}
+
+bool VideoItem::show(const VideoFrame& frame)
+{
+    if (frame.image.isNull())
+    {
+        if (!swapFrame(reinterpret_cast<const uchar*>(frame.raw.constData()), frame.pitch))
+            return false;
+    }
+    else
+    {
+        QImage back = backBuffer();
+        if (back.isNull())
+            return false;
+
+        QPainter painter(&back);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, frame.image);
+        painter.end();
+
+        damage(QRegion(back.rect()));
+        swapBuffers();
+    }
+
+    qint64 now = m_decoder.now();
+    qint64 queue = now - frame.decoded;
+
+    m_decodeTotal += frame.decodeTime;
+    m_decodeMax = std::max(m_decodeMax, frame.decodeTime);
+    m_queueTotal += queue;
+    m_queueMax = std::max(m_queueMax, queue);
+
+    m_presentedAt = now;
+    m_shown++;
+
+    return true;
+}
+
+unsigned long VideoItem::droppedCount()
+{
+    return m_late + m_decoder.overflows();
+}
+
+std::string VideoItem::json()
+{
+    auto ms = [](qint64 ns) { return ns / 1000000.0; };
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "shown", m_shown);
+    cJSON_AddNumberToObject(root, "dropped_decoder", m_decoder.overflows());
+    cJSON_AddNumberToObject(root, "dropped_display", m_late);
+    cJSON_AddNumberToObject(root, "stalls", m_stalls);
+    cJSON_AddNumberToObject(root, "decode_ms", m_shown ? ms(m_decodeTotal) / m_shown : 0);
+    cJSON_AddNumberToObject(root, "decode_max_ms", ms(m_decodeMax));
+    cJSON_AddNumberToObject(root, "queue_ms", m_shown ? ms(m_queueTotal) / m_shown : 0);
+    cJSON_AddNumberToObject(root, "queue_max_ms", ms(m_queueMax));
+    cJSON_AddNumberToObject(root, "display_ms",
+                            m_displayed ? ms(m_displayTotal) / m_displayed : 0);
+    cJSON_AddNumberToObject(root, "display_max_ms", ms(m_displayMax));
+
+    char* text = cJSON_PrintUnformatted(root);
+    std::string result(text ? text : "{}");
+    free(text);
+    cJSON_Delete(root);
+
+    return result;
+}
+
+VideoItem::~VideoItem()
+{
+    stop();
+    m_planes.removeVBlankHandler(m_vblankId);
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef VIDEOITEM_H
+#define VIDEOITEM_H
+
+#include "graphicsplaneitem.h"
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QWaitCondition>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+/**
+ * @brief A frame read by the VideoDecoder.
+ *
+ * Times are in nanoseconds on the stream clock, see VideoDecoder::now().
+ */
+struct VideoFrame
+{
+    VideoFrame()
+        : pts(0),
+          decoded(0),
+          decodeTime(0),
+          pitch(0)
+    {}
+
+    /**
+     * @brief When the frame is due on screen.
+     */
+    qint64 pts;
+
+    /**
+     * @brief When decoding the frame was done.
+     */
+    qint64 decoded;
+
+    /**
+     * @brief Time spent decoding the frame.
+     */
+    qint64 decodeTime;
+
+    /**
+     * @brief Content ready to paint, or null for a raw frame in the plane format.
+     */
+    QImage image;
+
+    /**
+     * @brief Raw frame in the plane format, the chroma plane following the luma plane.
+     */
+    QByteArray raw;
+    int pitch;
+};
+
+/**
+ * @brief The VideoDecoder class
+ *
+ * Reads a stream of frames on its own thread, either an image sequence from a directory or
+ * raw frames from a file, and loops over it at a fixed frame rate.
+ *
+ * Frames are decoded ahead of their presentation time into a bounded ring.  If the display
+ * falls behind and the ring is full, the oldest frame is dropped.  The latest frame wins.
+ */
+class VideoDecoder : public QThread
+{
+public:
+
+    /**
+     * @param capacity Number of frames in the ring.
+     */
+    VideoDecoder(unsigned int capacity = 3);
+
+    /**
+     * @brief Read the images of a directory in name order.
+     * @param path
+     * @param format QImage format to deliver images in.
+     * @return false if there is no image to read.
+     */
+    bool openSequence(const QString& path, QImage::Format format);
+
+    /**
+     * @brief Read raw frames from a file.
+     *
+     * RGB frames are delivered as images.  YUV frames are only delivered raw, so they must be
+     * in the plane format.
+     *
+     * @param path
+     * @param size Size of a frame.
+     * @param format DRM fourcc of the frames.
+     * @param image QImage format to deliver RGB frames in.
+     * @param passthrough Deliver frames raw, they are in the plane format.
+     * @return false if the file or format can't be used.
+     */
+    bool openRaw(const QString& path, const QSize& size, uint32_t format,
+                 QImage::Format image, bool passthrough);
+
+    /**
+     * @brief Start decoding.
+     * @param fps Frame rate of the stream.
+     */
+    void play(double fps);
+
+    /**
+     * @brief Stop decoding and drop the frames in the ring.
+     */
+    void stop();
+
+    /**
+     * @brief Take the latest frame that is due.
+     * @param frame
+     * @param skipped Number of due frames older than it, that are dropped.
+     * @return false if no frame is due.
+     */
+    bool take(VideoFrame& frame, unsigned long& skipped);
+
+    /**
+     * @brief Time on the stream clock, started by play().
+     */
+    qint64 now() const
+    {
+        return m_clock.nsecsElapsed();
+    }
+
+    QSize size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Number of frames dropped by the decoder, because the ring was full or decoding
+     * fell a whole frame behind.
+     */
+    unsigned long overflows();
+
+    virtual ~VideoDecoder();
+
+protected:
+
+    virtual void run() override;
+
+    bool decode(unsigned long index, VideoFrame& frame);
+
+    unsigned int m_capacity;
+
+    QStringList m_files;
+    QFile m_file;
+    unsigned long m_count;
+    QSize m_size;
+    uint32_t m_format;
+    QImage::Format m_imageFormat;
+    bool m_passthrough;
+
+    qint64 m_period;
+    QElapsedTimer m_clock;
+
+    QMutex m_lock;
+    QWaitCondition m_wake;
+    std::deque<VideoFrame> m_ring;
+    unsigned long m_overflows;
+    bool m_quit;
+};
+
+/**
+ * @brief The VideoItem class
+ *
+ * Plays a VideoDecoder stream on a plane.  Every vblank, the latest frame that is due is
+ * copied into a buffer of the swap chain of the plane and presented, so the number of
+ * buffers in the chain bounds how many frames are queued for scanout.  Frames that are
+ * overtaken before they reach the screen are dropped and counted.
+ *
+ * Without a plane, frames are composited by Qt, paced by a timer.  When the item moves to
+ * another plane, or to Qt, the stream is opened again in the format of the new target.
+ */
+class VideoItem : public GraphicsPlaneItem
+{
+public:
+
+    /**
+     * @param planes
+     * @param plane Plane to play on, or null to have it composited by Qt.
+     * @param ring Number of decoded frames to keep ahead.
+     */
+    VideoItem(PlaneManager& planes, struct plane_data* plane, unsigned int ring = 3);
+
+    /**
+     * @brief Play a stream in a loop.
+     *
+     * The item is resized to the frame size.
+     *
+     * @param path Directory of images, or a file of raw frames.
+     * @param fps
+     * @param rawSize Size of the raw frames, invalid for an image directory.
+     * @param rawFormat DRM fourcc of the raw frames.
+     * @return false if the stream can't be played.
+     */
+    bool play(const QString& path, double fps, const QSize& rawSize = QSize(),
+              uint32_t rawFormat = 0);
+
+    void stop();
+
+    /**
+     * @brief Number of frames presented so far.
+     */
+    unsigned long shownCount() const
+    {
+        return m_shown;
+    }
+
+    /**
+     * @brief Number of frames dropped so far, in the ring or at display.
+     */
+    unsigned long droppedCount();
+
+    /**
+     * @brief Decode, queue and display times, and dropped frames, as a JSON object.
+     */
+    std::string json();
+
+    virtual ~VideoItem();
+
+protected:
+
+    virtual void redraw() override;
+    virtual void planeChanged() override;
+
+    /**
+     * @brief Open the stream in the format of the current target and start decoding.
+     */
+    bool open();
+
+    /**
+     * @brief Pace frames by vblank events with a plane, or by a timer without.
+     */
+    void pace();
+
+    /**
+     * @brief Show the latest due frame, if a buffer is free.
+     */
+    void tick();
+
+    bool show(const VideoFrame& frame);
+
+    VideoDecoder m_decoder;
+    QString m_path;
+    double m_fps;
+    QSize m_rawSize;
+    uint32_t m_rawFormat;
+
+    int m_vblankId;
+    QTimer m_timer;
+    bool m_playing;
+
+    /**
+     * @brief A due frame that is waiting for a free buffer.
+     */
+    VideoFrame m_held;
+    bool m_holding;
+
+    /**
+     * @brief When the last frame was presented, or -1 once it is on screen.
+     */
+    qint64 m_presentedAt;
+
+    unsigned long m_shown;
+    unsigned long m_late;
+    unsigned long m_stalls;
+
+    qint64 m_decodeTotal;
+    qint64 m_decodeMax;
+    qint64 m_queueTotal;
+    qint64 m_queueMax;
+    qint64 m_displayTotal;
+    qint64 m_displayMax;
+    unsigned long m_displayed;
+};
+
+#endif // VIDEOITEM_H